@@ -102,17 +102,27 @@ demo_atlas_set_uniforms (demo_atlas_t *at)
   glUniform1i (glGetUniformLocation (program, "u_atlas_tex"), at->tex_unit - GL_TEXTURE0);
 }
 
+void
+demo_atlas_get_item_geometry (demo_atlas_t *at,
+			      unsigned int *item_w,
+			      unsigned int *item_h_quantum)
+{
+  *item_w = at->item_w;
+  *item_h_quantum = at->item_h_q;
+}
+
 void
 demo_atlas_alloc (demo_atlas_t  *at,
 		  glyphy_rgba_t *data,
-		  unsigned int   len,
+		  unsigned int   rows,
 		  unsigned int  *px,
 		  unsigned int  *py)
 {
   GLuint w, h, x, y;
 
   w = at->item_w;
-  h = (len + w - 1) / w;
+  h = rows;
+  assert (h % at->item_h_q == 0);
 
   if (at->cursor_y + h > at->tex_h) {
     /* Go to next column */
@@ -125,19 +135,12 @@ demo_atlas_alloc (demo_atlas_t  *at,
   {
     x = at->cursor_x;
     y = at->cursor_y;
-    at->cursor_y += (h + at->item_h_q - 1) & ~(at->item_h_q - 1);
+    at->cursor_y += h;
   } else
     die ("Ran out of atlas memory");
 
   demo_atlas_bind_texture (at);
-  if (w * h == len)
-    gl(TexSubImage2D) (GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
-  else {
-    gl(TexSubImage2D) (GL_TEXTURE_2D, 0, x, y, w, h - 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    /* Upload the last row separately */
-    gl(TexSubImage2D) (GL_TEXTURE_2D, 0, x, y + h - 1, len - (w * (h - 1)), 1, GL_RGBA, GL_UNSIGNED_BYTE,
-		       data + w * (h - 1));
-  }
+  gl(TexSubImage2D) (GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, data);
 
   *px = x / at->item_w;
   *py = y / at->item_h_q;
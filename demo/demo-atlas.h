@@ -37,10 +37,17 @@ void
 demo_atlas_destroy (demo_atlas_t *at);
 
 
+void
+demo_atlas_get_item_geometry (demo_atlas_t *at,
+			      unsigned int *item_w,
+			      unsigned int *item_h_quantum);
+
+/* data holds rows rows of item_w texels, as glyphy_blob_encoder_encode_to_rows()
+ * lays them out; rows must be a multiple of the height quantum. */
 void
 demo_atlas_alloc (demo_atlas_t  *at,
 		  glyphy_rgba_t *data,
-		  unsigned int   len,
+		  unsigned int   rows,
 		  unsigned int  *px,
 		  unsigned int  *py);
 
@@ -36,6 +36,8 @@ struct demo_font_t {
   glyph_cache_t *glyph_cache;
   demo_atlas_t  *atlas;
   glyphy_arc_accumulator_t *acc;
+  glyphy_blob_encoder_t *encoder;
+  std::vector<glyphy_rgba_t> *item; /* atlas item being encoded; kept across glyphs */
 
   /* stats */
   unsigned int num_glyphs;
@@ -56,6 +58,8 @@ demo_font_create (FT_Face       face,
   font->glyph_cache = new glyph_cache_t ();
   font->atlas = demo_atlas_reference (atlas);
   font->acc = glyphy_arc_accumulator_create ();
+  font->encoder = glyphy_blob_encoder_create ();
+  font->item = new std::vector<glyphy_rgba_t> ();
 
   font->num_glyphs = 0;
   font->sum_error  = 0;
@@ -79,6 +83,8 @@ demo_font_destroy (demo_font_t *font)
   if (!font || --font->refcount)
     return;
 
+  delete font->item;
+  glyphy_blob_encoder_destroy (font->encoder);
   glyphy_arc_accumulator_destroy (font->acc);
   demo_atlas_destroy (font->atlas);
   delete font->glyph_cache;
@@ -99,20 +105,11 @@ demo_font_get_atlas (demo_font_t *font)
 }
 
 
-static glyphy_bool_t
-accumulate_endpoint (glyphy_arc_endpoint_t         *endpoint,
-		     std::vector<glyphy_arc_endpoint_t> *endpoints)
-{
-  endpoints->push_back (*endpoint);
-  return true;
-}
-
 static void
 encode_ft_glyph (demo_font_t      *font,
 		 unsigned int      glyph_index,
 		 double            tolerance_per_em,
-		 glyphy_rgba_t    *buffer,
-		 unsigned int      buffer_len,
+		 unsigned int     *rows,
 		 unsigned int     *output_len,
 		 unsigned int     *nominal_width,
 		 unsigned int     *nominal_height,
@@ -139,53 +136,68 @@ encode_ft_glyph (demo_font_t      *font,
   unsigned int upem = face->units_per_EM;
   double tolerance = upem * tolerance_per_em; /* in font design units */
   double faraway = double (upem) / (MIN_FONT_SIZE * M_SQRT2);
-  std::vector<glyphy_arc_endpoint_t> endpoints;
 
   glyphy_arc_accumulator_reset (font->acc);
   glyphy_arc_accumulator_set_tolerance (font->acc, tolerance);
-  glyphy_arc_accumulator_set_callback (font->acc,
-				       (glyphy_arc_endpoint_accumulator_callback_t) accumulate_endpoint,
-				       &endpoints);
 
   if (FT_Err_Ok != glyphy_freetype(outline_decompose) (&face->glyph->outline, font->acc))
     die ("Failed converting glyph outline to arcs");
 
   assert (glyphy_arc_accumulator_get_error (font->acc) <= tolerance);
 
-  if (endpoints.size ())
+  unsigned int num_endpoints;
+  glyphy_arc_endpoint_t *endpoints = glyphy_arc_accumulator_get_endpoints (font->acc, &num_endpoints);
+
+  if (num_endpoints)
   {
 #if 0
     /* Technically speaking, we want the following code,
      * however, crappy fonts have crappy flags.  So we just
      * fixup unconditionally... */
     if (face->glyph->outline.flags & FT_OUTLINE_EVEN_ODD_FILL)
-      glyphy_outline_winding_from_even_odd (&endpoints[0], endpoints.size (), false);
+      glyphy_outline_winding_from_even_odd (endpoints, num_endpoints, false);
     else if (face->glyph->outline.flags & FT_OUTLINE_REVERSE_FILL)
-      glyphy_outline_reverse (&endpoints[0], endpoints.size ());
+      glyphy_outline_reverse (endpoints, num_endpoints);
 #else
-    glyphy_outline_winding_from_even_odd (&endpoints[0], endpoints.size (), false);
+    glyphy_outline_winding_from_even_odd (endpoints, num_endpoints, false);
 #endif
   }
 
   if (SCALE != 1.)
-    for (unsigned int i = 0; i < endpoints.size (); i++)
+    for (unsigned int i = 0; i < num_endpoints; i++)
     {
       endpoints[i].p.x /= SCALE;
       endpoints[i].p.y /= SCALE;
     }
 
+  /* Encode straight into the atlas item layout.  If the item buffer is
+   * too small, grow it and go again; that only copies. */
+  std::vector<glyphy_rgba_t> &buffer = *font->item;
+  unsigned int item_w, item_h_q;
+  demo_atlas_get_item_geometry (font->atlas, &item_w, &item_h_q);
   double avg_fetch_achieved;
-  if (!glyphy_arc_list_encode_blob (endpoints.size () ? &endpoints[0] : NULL, endpoints.size (),
-				    buffer,
-				    buffer_len,
-				    faraway / SCALE,
-				    4, /* UNUSED */
-				    &avg_fetch_achieved,
-				    output_len,
-				    nominal_width,
-				    nominal_height,
-				    extents))
-    die ("Failed encoding arcs");
+  for (unsigned int pass = 0; pass < 2; pass++)
+  {
+    if (glyphy_blob_encoder_encode_to_rows (font->encoder,
+					    endpoints, num_endpoints,
+					    buffer.size () ? &buffer[0] : NULL,
+					    item_w, /* stride */
+					    item_w,
+					    buffer.size () / item_w,
+					    item_h_q,
+					    rows,
+					    faraway / SCALE,
+					    4, /* avg_fetch_desired */
+					    &avg_fetch_achieved,
+					    output_len,
+					    nominal_width,
+					    nominal_height,
+					    extents))
+      break;
+    if (pass)
+      die ("Failed encoding arcs");
+    buffer.resize (*rows * item_w);
+  }
 
   glyphy_extents_scale (extents, 1. / upem, 1. / upem);
   glyphy_extents_scale (extents, SCALE, SCALE);
@@ -193,11 +205,12 @@ encode_ft_glyph (demo_font_t      *font,
   *advance = face->glyph->metrics.horiAdvance / (double) upem;
 
   if (0)
-    LOGI ("gid%3u: endpoints%3d; err%3g%%; tex fetch%4.1f; mem%4.1fkb\n",
+    LOGI ("gid%3u: endpoints%3d; err%3g%%; tex fetch%4.1f; grid %2ux%2u; mem%4.1fkb\n",
 	  glyph_index,
 	  (unsigned int) glyphy_arc_accumulator_get_num_endpoints (font->acc),
 	  round (100 * glyphy_arc_accumulator_get_error (font->acc) / tolerance),
 	  avg_fetch_achieved,
+	  *nominal_width, *nominal_height,
 	  (*output_len * sizeof (glyphy_rgba_t)) / 1024.);
 
   font->num_glyphs++;
@@ -212,13 +225,12 @@ _demo_font_upload_glyph (demo_font_t *font,
 			 unsigned int glyph_index,
 			 glyph_info_t *glyph_info)
 {
-  glyphy_rgba_t buffer[4096 * 16];
-  unsigned int output_len;
+  unsigned int rows, output_len;
 
   encode_ft_glyph (font,
 		   glyph_index,
 		   TOLERANCE,
-		   buffer, ARRAY_LEN (buffer),
+		   &rows,
 		   &output_len,
 		   &glyph_info->nominal_w,
 		   &glyph_info->nominal_h,
@@ -227,7 +239,7 @@ _demo_font_upload_glyph (demo_font_t *font,
 
   glyph_info->is_empty = glyphy_extents_is_empty (&glyph_info->extents);
   if (!glyph_info->is_empty)
-    demo_atlas_alloc (font->atlas, buffer, output_len,
+    demo_atlas_alloc (font->atlas, &(*font->item)[0], rows,
 		      &glyph_info->atlas_x, &glyph_info->atlas_y);
 }
 
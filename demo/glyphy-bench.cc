@@ -0,0 +1,376 @@
+/*
+ * Copyright 2012 Google, Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Google Author(s): Behdad Esfahbod
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <vector>
+
+#include <glyphy-freetype.h>
+
+/* Same as the demo uses. */
+#define MIN_FONT_SIZE 10
+#define AVG_FETCH_DESIRED 4
+
+using namespace std;
+
+static inline void
+die (const char *msg)
+{
+  fprintf (stderr, "%s\n", msg);
+  exit (1);
+}
+
+static double
+now (void)
+{
+  struct timespec t;
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+struct glyph_t
+{
+  vector<glyphy_arc_endpoint_t> endpoints;
+  double faraway;
+};
+
+/* Winding fixup asserts on contours that don't close; the odd broken
+ * glyph in a font is left out instead. */
+static bool
+contours_closed (const vector<glyphy_arc_endpoint_t> &endpoints)
+{
+  unsigned int start = 0;
+  for (unsigned int i = 1; i <= endpoints.size (); i++)
+    if (i == endpoints.size () || isinf (endpoints[i].d))
+    {
+      unsigned int n = i - start;
+      if (n && (n < 3 ||
+		endpoints[start].p.x != endpoints[i - 1].p.x ||
+		endpoints[start].p.y != endpoints[i - 1].p.y))
+	return false;
+      start = i;
+    }
+  return true;
+}
+
+/* Endpoints are collected through the callback, which every version of
+ * the accumulator has, so the same benchmark builds against old trees. */
+static glyphy_bool_t
+accumulate_endpoint (glyphy_arc_endpoint_t         *endpoint,
+		     vector<glyphy_arc_endpoint_t> *endpoints)
+{
+  endpoints->push_back (*endpoint);
+  return true;
+}
+
+/* Accumulates every glyph of every face of font_path, at a tolerance of
+ * upem / tolerance_divisor, and appends the winding-fixed outlines. */
+static void
+load_glyphs (FT_Library       ft_library,
+	     const char      *font_path,
+	     double           tolerance_divisor,
+	     vector<glyph_t> &glyphs)
+{
+  glyphy_arc_accumulator_t *acc = glyphy_arc_accumulator_create ();
+
+  unsigned int num_faces = 1;
+  for (unsigned int face_index = 0; face_index < num_faces; face_index++)
+  {
+    FT_Face ft_face = NULL;
+    FT_New_Face (ft_library, font_path, face_index, &ft_face);
+    if (!ft_face)
+      die ("Failed to open font file");
+    num_faces = ft_face->num_faces;
+
+    unsigned int upem = ft_face->units_per_EM;
+    glyphy_arc_accumulator_set_tolerance (acc, upem / tolerance_divisor);
+
+    for (unsigned int glyph_index = 0; glyph_index < ft_face->num_glyphs; glyph_index++)
+    {
+      if (FT_Err_Ok != FT_Load_Glyph (ft_face,
+				      glyph_index,
+				      FT_LOAD_NO_BITMAP |
+				      FT_LOAD_NO_HINTING |
+				      FT_LOAD_NO_AUTOHINT |
+				      FT_LOAD_NO_SCALE |
+				      FT_LOAD_LINEAR_DESIGN |
+				      FT_LOAD_IGNORE_TRANSFORM) ||
+	  ft_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+	continue;
+
+      glyph_t glyph;
+      glyph.faraway = double (upem) / (MIN_FONT_SIZE * M_SQRT2);
+
+      glyphy_arc_accumulator_reset (acc);
+      glyphy_arc_accumulator_set_callback (acc,
+					   (glyphy_arc_endpoint_accumulator_callback_t) accumulate_endpoint,
+					   &glyph.endpoints);
+      if (FT_Err_Ok != glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc))
+	continue;
+
+      if (!contours_closed (glyph.endpoints))
+	continue;
+      if (glyph.endpoints.size ())
+	glyphy_outline_winding_from_even_odd (&glyph.endpoints[0], glyph.endpoints.size (), false);
+
+      glyphs.push_back (glyph);
+    }
+
+    FT_Done_Face (ft_face);
+  }
+
+  glyphy_arc_accumulator_destroy (acc);
+}
+
+
+/* Times turning every glyph of every face of the fonts into arcs.  Only
+ * the outline decomposition and accumulation are timed, not loading. */
+static void
+bench_accumulate (FT_Library   ft_library,
+		  char       **font_paths,
+		  unsigned int num_fonts,
+		  double       tolerance_divisor)
+{
+  glyphy_arc_accumulator_t *acc = glyphy_arc_accumulator_create ();
+  vector<glyphy_arc_endpoint_t> endpoints;
+  glyphy_arc_accumulator_set_callback (acc,
+				       (glyphy_arc_endpoint_accumulator_callback_t) accumulate_endpoint,
+				       &endpoints);
+  unsigned int num_glyphs = 0, over_tolerance = 0;
+  unsigned long num_endpoints = 0;
+  double elapsed = 0;
+
+  for (unsigned int font = 0; font < num_fonts; font++)
+  {
+    unsigned int num_faces = 1;
+    for (unsigned int face_index = 0; face_index < num_faces; face_index++)
+    {
+      FT_Face ft_face = NULL;
+      FT_New_Face (ft_library, font_paths[font], face_index, &ft_face);
+      if (!ft_face)
+	die ("Failed to open font file");
+      num_faces = ft_face->num_faces;
+
+      double tolerance = ft_face->units_per_EM / tolerance_divisor;
+      glyphy_arc_accumulator_set_tolerance (acc, tolerance);
+
+      for (unsigned int glyph_index = 0; glyph_index < ft_face->num_glyphs; glyph_index++)
+      {
+	if (FT_Err_Ok != FT_Load_Glyph (ft_face,
+					glyph_index,
+					FT_LOAD_NO_BITMAP |
+					FT_LOAD_NO_HINTING |
+					FT_LOAD_NO_AUTOHINT |
+					FT_LOAD_NO_SCALE |
+					FT_LOAD_LINEAR_DESIGN |
+					FT_LOAD_IGNORE_TRANSFORM) ||
+	    ft_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+	  continue;
+
+	endpoints.clear ();
+	double start = now ();
+	glyphy_arc_accumulator_reset (acc);
+	FT_Error error = glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc);
+	elapsed += now () - start;
+	if (FT_Err_Ok != error)
+	  continue;
+
+	num_glyphs++;
+	num_endpoints += endpoints.size ();
+	if (glyphy_arc_accumulator_get_error (acc) > tolerance)
+	  over_tolerance++;
+      }
+
+      FT_Done_Face (ft_face);
+    }
+  }
+
+  glyphy_arc_accumulator_destroy (acc);
+
+  printf ("accumulate: %u glyphs in %.3fs (%.1fus/glyph); %lu endpoints; %u over tolerance\n",
+	  num_glyphs, elapsed, elapsed * 1e6 / num_glyphs, num_endpoints, over_tolerance);
+}
+
+
+/* Times glyphy_arc_list_encode_blob() over all glyphs.  The hash tells
+ * whether two builds produce the same blobs. */
+static void
+bench_encode (const vector<glyph_t> &glyphs, double avg_fetch_desired)
+{
+  vector<glyphy_rgba_t> buffer (1 << 16);
+  unsigned long long hash = 14695981039346656037ull; /* FNV-1a */
+  double sum_fetch = 0;
+  unsigned long total_len = 0;
+
+  double start = now ();
+  for (unsigned int i = 0; i < glyphs.size (); i++)
+  {
+    const vector<glyphy_arc_endpoint_t> &endpoints = glyphs[i].endpoints;
+    double avg_fetch_achieved;
+    unsigned int output_len, nominal_width, nominal_height;
+    glyphy_extents_t extents;
+    if (!glyphy_arc_list_encode_blob (endpoints.size () ? &endpoints[0] : NULL, endpoints.size (),
+				      &buffer[0], buffer.size (),
+				      glyphs[i].faraway,
+				      avg_fetch_desired,
+				      &avg_fetch_achieved,
+				      &output_len,
+				      &nominal_width,
+				      &nominal_height,
+				      &extents))
+      die ("Failed encoding arcs");
+
+    const unsigned char *bytes = (const unsigned char *) &buffer[0];
+    for (unsigned int j = 0; j < output_len * sizeof (glyphy_rgba_t); j++)
+      hash = (hash ^ bytes[j]) * 1099511628211ull;
+    sum_fetch += avg_fetch_achieved;
+    total_len += output_len;
+  }
+  double elapsed = now () - start;
+
+  printf ("encode: %u glyphs in %.3fs (%.1fus/glyph); %.2f MB, avg fetch %.2f; blob hash %016llx\n",
+	  (unsigned int) glyphs.size (), elapsed, elapsed * 1e6 / glyphs.size (),
+	  total_len * sizeof (glyphy_rgba_t) / 1e6, sum_fetch / glyphs.size (),
+	  hash);
+}
+
+/* Times glyphy_sdf_from_blob_batch() against glyphy_sdf_from_arc_list()
+ * on the full outline, at the same grid of points over each glyph. */
+static void
+bench_sdf (const vector<glyph_t> &glyphs, double avg_fetch_desired)
+{
+  const unsigned int samples = 32; /* per side */
+  vector<glyphy_rgba_t> buffer (1 << 16);
+  vector<glyphy_point_t> points (samples * samples), nominal_points (samples * samples);
+  vector<double> arc_list_sdfs (samples * samples), blob_sdfs (samples * samples);
+  double arc_list_time = 0, blob_time = 0, max_diff = 0;
+  unsigned long num_points = 0;
+
+  for (unsigned int i = 0; i < glyphs.size (); i++)
+  {
+    const vector<glyphy_arc_endpoint_t> &endpoints = glyphs[i].endpoints;
+    if (endpoints.empty ())
+      continue;
+
+    double avg_fetch_achieved;
+    unsigned int output_len, nominal_width, nominal_height;
+    glyphy_extents_t extents;
+    if (!glyphy_arc_list_encode_blob (&endpoints[0], endpoints.size (),
+				      &buffer[0], buffer.size (),
+				      glyphs[i].faraway,
+				      avg_fetch_desired,
+				      &avg_fetch_achieved,
+				      &output_len,
+				      &nominal_width,
+				      &nominal_height,
+				      &extents))
+      die ("Failed encoding arcs");
+
+    /* The blob works in nominal coordinates: extents mapped to the grid. */
+    double scale = nominal_width / (extents.max_x - extents.min_x);
+    for (unsigned int k = 0; k < samples * samples; k++)
+    {
+      nominal_points[k].x = (k % samples + .5) * nominal_width / samples;
+      nominal_points[k].y = (k / samples + .5) * nominal_height / samples;
+      points[k].x = extents.min_x + nominal_points[k].x / scale;
+      points[k].y = extents.min_y + nominal_points[k].y / scale;
+    }
+
+    double start = now ();
+    for (unsigned int k = 0; k < samples * samples; k++)
+      arc_list_sdfs[k] = glyphy_sdf_from_arc_list (&endpoints[0], endpoints.size (), &points[k], NULL);
+    double middle = now ();
+    glyphy_sdf_from_blob_batch (&buffer[0], nominal_width, nominal_height,
+				&nominal_points[0], samples * samples, &blob_sdfs[0]);
+    double end = now ();
+    arc_list_time += middle - start;
+    blob_time += end - middle;
+    num_points += samples * samples;
+
+    /* Away from the outline the shader approximates; compare close by. */
+    for (unsigned int k = 0; k < samples * samples; k++)
+      if (fabs (blob_sdfs[k]) < .1)
+	max_diff = std::max (max_diff, fabs (arc_list_sdfs[k] * scale - blob_sdfs[k]));
+  }
+
+  printf ("sdf: %lu points; arc list %.3fs, blob %.3fs (%.1fx); "
+	  "max difference near the outline %.3g nominal units\n",
+	  num_points, arc_list_time, blob_time, arc_list_time / blob_time, max_diff);
+}
+
+
+int
+main (int argc, char** argv)
+{
+  double tolerance_divisor = 2048;
+  double avg_fetch_desired = AVG_FETCH_DESIRED;
+
+  for (; argc > 1 && argv[1][0] == '-'; argc--, argv++)
+  {
+    if (argc > 2 && 0 == strcmp (argv[1], "--tolerance")) {
+      tolerance_divisor = atof (argv[2]);
+      argc--;
+      argv++;
+    } else if (argc > 2 && 0 == strcmp (argv[1], "--avg-fetch")) {
+      avg_fetch_desired = atof (argv[2]);
+      argc--;
+      argv++;
+    } else
+      break;
+  }
+
+  if (argc < 3 || tolerance_divisor <= 0) {
+    fprintf (stderr, "Usage: %s [--tolerance UPEM_DIVISOR] [--avg-fetch N] accumulate|encode|sdf FONT_FILE...\n", argv[0]);
+    exit (1);
+  }
+  const char *mode = argv[1];
+
+  FT_Library ft_library;
+  FT_Init_FreeType (&ft_library);
+
+  if (0 == strcmp (mode, "accumulate")) {
+    bench_accumulate (ft_library, argv + 2, argc - 2, tolerance_divisor);
+    FT_Done_FreeType (ft_library);
+    return 0;
+  }
+
+  vector<glyph_t> glyphs;
+  for (int arg = 2; arg < argc; arg++)
+    load_glyphs (ft_library, argv[arg], tolerance_divisor, glyphs);
+  if (glyphs.empty ())
+    die ("No glyphs");
+
+  if (0 == strcmp (mode, "encode"))
+    bench_encode (glyphs, avg_fetch_desired);
+  else if (0 == strcmp (mode, "sdf"))
+    bench_sdf (glyphs, avg_fetch_desired);
+  else
+    die ("Unknown mode");
+
+  FT_Done_FreeType (ft_library);
+
+  return 0;
+}
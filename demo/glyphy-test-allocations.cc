@@ -0,0 +1,201 @@
+/*
+ * Copyright 2012 Google, Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Google Author(s): Behdad Esfahbod
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <new>
+
+#include <glyphy-freetype.h>
+
+#include "default-font.h"
+
+/* Checks that once the arc accumulator has seen a set of glyphs, it
+ * turns them into arcs again without allocating: its scratch buffers
+ * survive glyphy_arc_accumulator_reset().  Checks with and without extra
+ * levels of detail.  Uses the demo's default font, or the font files
+ * given, and some cubic curves, which TrueType fonts do not have. */
+
+static unsigned long num_allocations;
+static bool counting;
+
+void *
+operator new (size_t size)
+{
+  if (counting)
+    num_allocations++;
+  void *p = malloc (size ? size : 1);
+  if (!p)
+    throw std::bad_alloc ();
+  return p;
+}
+
+void *
+operator new[] (size_t size)
+{
+  return operator new (size);
+}
+
+void
+operator delete (void *p) throw ()
+{
+  free (p);
+}
+
+void
+operator delete[] (void *p) throw ()
+{
+  free (p);
+}
+
+void
+operator delete (void *p, size_t) throw ()
+{
+  free (p);
+}
+
+void
+operator delete[] (void *p, size_t) throw ()
+{
+  free (p);
+}
+
+static inline void
+die (const char *msg)
+{
+  fprintf (stderr, "%s\n", msg);
+  exit (1);
+}
+
+/* Accumulates every glyph of ft_face; returns allocations made doing so. */
+static unsigned long
+accumulate_face (FT_Face ft_face, glyphy_arc_accumulator_t *acc)
+{
+  unsigned long before = num_allocations;
+
+  for (unsigned int glyph_index = 0; glyph_index < ft_face->num_glyphs; glyph_index++)
+  {
+    if (FT_Err_Ok != FT_Load_Glyph (ft_face,
+				    glyph_index,
+				    FT_LOAD_NO_BITMAP |
+				    FT_LOAD_NO_HINTING |
+				    FT_LOAD_NO_AUTOHINT |
+				    FT_LOAD_NO_SCALE |
+				    FT_LOAD_LINEAR_DESIGN |
+				    FT_LOAD_IGNORE_TRANSFORM) ||
+	ft_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+      continue;
+
+    counting = true;
+    glyphy_arc_accumulator_reset (acc);
+    FT_Error error = glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc);
+    counting = false;
+    if (FT_Err_Ok != error)
+      die ("Failed converting glyph outline to arcs");
+  }
+
+  return num_allocations - before;
+}
+
+/* Accumulates contours of cubics, S-shaped ones with inflections among
+ * them, spanning size; returns allocations made doing so. */
+static unsigned long
+accumulate_cubics (glyphy_arc_accumulator_t *acc, double size)
+{
+  unsigned long before = num_allocations;
+
+  for (unsigned int i = 0; i < 16; i++)
+  {
+    double s = size * (i + 1) / 16;
+    glyphy_point_t p0 = {0, 0};
+    glyphy_point_t s1 = {s, 0}, s2 = {0, s * (i % 4 + 1) / 4}, s3 = {s, s};
+    glyphy_point_t c1 = {0, s}, c2 = {s * i / 16, s}, c3 = {0, 0};
+
+    counting = true;
+    glyphy_arc_accumulator_reset (acc);
+    glyphy_arc_accumulator_move_to (acc, &p0);
+    glyphy_arc_accumulator_cubic_to (acc, &s1, &s2, &s3);
+    glyphy_arc_accumulator_cubic_to (acc, &c1, &c2, &c3);
+    glyphy_arc_accumulator_close_path (acc);
+    counting = false;
+  }
+
+  return num_allocations - before;
+}
+
+static bool
+check_face (FT_Face ft_face, const char *name, bool lods)
+{
+  unsigned int upem = ft_face->units_per_EM;
+  glyphy_arc_accumulator_t *acc = glyphy_arc_accumulator_create ();
+  glyphy_arc_accumulator_set_tolerance (acc, upem / 2048.);
+  if (lods) {
+    double tolerances[] = {upem / 128., upem / 512.};
+    glyphy_arc_accumulator_set_lod_tolerances (acc, tolerances, 2);
+  }
+
+  unsigned long first = accumulate_face (ft_face, acc) + accumulate_cubics (acc, upem);
+  unsigned long second = accumulate_face (ft_face, acc) + accumulate_cubics (acc, upem);
+  printf ("%s%s: %lu allocations on the first pass, %lu on the second\n",
+	  name, lods ? ", with levels of detail" : "", first, second);
+
+  glyphy_arc_accumulator_destroy (acc);
+  return second == 0;
+}
+
+static bool
+check (FT_Face ft_face, const char *name)
+{
+  bool ok = check_face (ft_face, name, false);
+  return check_face (ft_face, name, true) && ok;
+}
+
+int
+main (int argc, char** argv)
+{
+  FT_Library ft_library;
+  FT_Init_FreeType (&ft_library);
+
+  bool ok = true;
+  if (argc == 1)
+  {
+    FT_Face ft_face = NULL;
+    FT_New_Memory_Face (ft_library, (const FT_Byte *) default_font, sizeof (default_font), 0, &ft_face);
+    if (!ft_face)
+      die ("Failed to open default font");
+    ok = check (ft_face, "default font") && ok;
+    FT_Done_Face (ft_face);
+  }
+  for (int arg = 1; arg < argc; arg++)
+  {
+    FT_Face ft_face = NULL;
+    FT_New_Face (ft_library, argv[arg], 0, &ft_face);
+    if (!ft_face)
+      die ("Failed to open font file");
+    ok = check (ft_face, argv[arg]) && ok;
+    FT_Done_Face (ft_face);
+  }
+
+  FT_Done_FreeType (ft_library);
+
+  return ok ? 0 : 1;
+}
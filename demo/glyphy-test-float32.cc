@@ -0,0 +1,271 @@
+/*
+ * Copyright 2012 Google, Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Google Author(s): Behdad Esfahbod
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <glyphy-freetype.h>
+
+#include "default-font.h"
+
+/* Checks the single-precision pipeline against the double one, on the
+ * demo's default font or the font files given:
+ *
+ * - Accumulating into a float32 buffer gives as many endpoints.
+ *
+ * - Near the outline, the blob encoded from the float32 endpoints gives
+ *   the same distances as the one from the double endpoints, within the
+ *   accumulator tolerance.  Blobs differ only where rounding moved a
+ *   quantized endpoint.
+ *
+ * - glyphy_sdf_from_arc_list32_batch() agrees with the double batch SDF
+ *   on the same endpoints to within a hundredth of the tolerance.  The
+ *   sign may differ where a point is equally close to two arcs running
+ *   on opposite sides, as with overlapping contours; either sign is right
+ *   there, and the two precisions may break the tie differently.
+ */
+
+#define TOLERANCE (1./2048)
+#define MIN_FONT_SIZE 10
+#define SAMPLES 16 /* per side, per glyph */
+
+using namespace std;
+
+static inline void
+die (const char *msg)
+{
+  fprintf (stderr, "%s\n", msg);
+  exit (1);
+}
+
+struct results_t
+{
+  unsigned int num_glyphs;
+  unsigned int bad_glyphs;
+  unsigned int differing_blobs;
+  unsigned long num_points;
+  unsigned int ties;
+  double max_blob_diff; /* in tolerances */
+  double max_sdf_diff; /* in tolerances */
+};
+
+/* Distance from p, in font units, as the shader would compute it from blob. */
+static double
+blob_sdf (const glyphy_rgba_t    *blob,
+	  unsigned int            nominal_width,
+	  unsigned int            nominal_height,
+	  const glyphy_extents_t &extents,
+	  const glyphy_point_t   &p)
+{
+  double scale = nominal_width / (extents.max_x - extents.min_x);
+  glyphy_point_t nominal_p = {(p.x - extents.min_x) * scale,
+			      (p.y - extents.min_y) * scale};
+  return glyphy_sdf_from_blob (blob, nominal_width, nominal_height, &nominal_p) / scale;
+}
+
+/* Whether two arcs of opposite sides are, within epsilon, both closest to p. */
+static bool
+is_tie (const vector<glyphy_arc_endpoint_t> &endpoints,
+	const glyphy_point_t                &p,
+	double                               epsilon)
+{
+  double inside = INFINITY, outside = INFINITY;
+  for (unsigned int i = 1; i < endpoints.size (); i++)
+  {
+    if (isinf (endpoints[i].d))
+      continue;
+    glyphy_arc_endpoint_t arc[2] = {endpoints[i - 1], endpoints[i]};
+    arc[0].d = INFINITY;
+    double sdf = glyphy_sdf_from_arc_list (arc, 2, &p, NULL);
+    if (sdf < 0)
+      inside = min (inside, -sdf);
+    else
+      outside = min (outside, sdf);
+  }
+  return fabs (inside - outside) <= epsilon;
+}
+
+static void
+check_face (FT_Face ft_face, results_t &results)
+{
+  unsigned int upem = ft_face->units_per_EM;
+  double tolerance = upem * TOLERANCE;
+  double faraway = double (upem) / (MIN_FONT_SIZE * M_SQRT2);
+
+  glyphy_arc_accumulator_t *acc = glyphy_arc_accumulator_create ();
+  glyphy_arc_accumulator_t *acc32 = glyphy_arc_accumulator_create ();
+  glyphy_arc_accumulator_set_tolerance (acc, tolerance);
+  glyphy_arc_accumulator_set_tolerance (acc32, tolerance);
+  vector<glyphy_arc_endpoint32_t> endpoints32 (1 << 16);
+  glyphy_arc_accumulator_set_buffer32 (acc32, &endpoints32[0], endpoints32.size ());
+
+  vector<glyphy_arc_endpoint_t> endpoints, widened;
+  vector<glyphy_rgba_t> blob (1 << 16), blob32 (1 << 16);
+  vector<glyphy_point_t> points (SAMPLES * SAMPLES);
+  vector<glyphy_point32_t> points32 (SAMPLES * SAMPLES);
+  vector<double> sdfs (SAMPLES * SAMPLES);
+  vector<float> sdfs32 (SAMPLES * SAMPLES);
+
+  for (unsigned int glyph_index = 0; glyph_index < ft_face->num_glyphs; glyph_index++)
+  {
+    if (FT_Err_Ok != FT_Load_Glyph (ft_face,
+				    glyph_index,
+				    FT_LOAD_NO_BITMAP |
+				    FT_LOAD_NO_HINTING |
+				    FT_LOAD_NO_AUTOHINT |
+				    FT_LOAD_NO_SCALE |
+				    FT_LOAD_LINEAR_DESIGN |
+				    FT_LOAD_IGNORE_TRANSFORM) ||
+	ft_face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+      continue;
+
+    glyphy_arc_accumulator_reset (acc);
+    glyphy_arc_accumulator_reset (acc32);
+    if (FT_Err_Ok != glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc) ||
+	FT_Err_Ok != glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc32))
+      die ("Failed converting glyph outline to arcs");
+
+    unsigned int num_endpoints;
+    glyphy_arc_endpoint_t *p = glyphy_arc_accumulator_get_endpoints (acc, &num_endpoints);
+    endpoints.assign (p, p + num_endpoints);
+    if (!num_endpoints)
+      continue;
+    results.num_glyphs++;
+
+    if (glyphy_arc_accumulator_get_num_endpoints (acc32) != num_endpoints) {
+      fprintf (stderr, "glyph %u: %u endpoints in double, %u in float\n",
+	       glyph_index, num_endpoints, glyphy_arc_accumulator_get_num_endpoints (acc32));
+      results.bad_glyphs++;
+      continue;
+    }
+
+    unsigned int output_len, output_len32;
+    unsigned int nominal_width, nominal_height, nominal_width32, nominal_height32;
+    glyphy_extents_t extents, extents32;
+    if (!glyphy_arc_list_encode_blob (&endpoints[0], num_endpoints,
+				      &blob[0], blob.size (),
+				      faraway, 4, NULL,
+				      &output_len, &nominal_width, &nominal_height, &extents) ||
+	!glyphy_arc_list_encode_blob32 (&endpoints32[0], num_endpoints,
+					&blob32[0], blob32.size (),
+					faraway, 4, NULL,
+					&output_len32, &nominal_width32, &nominal_height32, &extents32))
+      die ("Failed encoding arcs");
+    if (output_len != output_len32 ||
+	nominal_width != nominal_width32 || nominal_height != nominal_height32 ||
+	memcmp (&blob[0], &blob32[0], output_len * sizeof (blob[0])))
+      results.differing_blobs++;
+
+    /* Points are rounded to float, so both sides see the same ones. */
+    for (unsigned int k = 0; k < SAMPLES * SAMPLES; k++)
+    {
+      points32[k].x = extents.min_x + (k % SAMPLES + .5) * (extents.max_x - extents.min_x) / SAMPLES;
+      points32[k].y = extents.min_y + (k / SAMPLES + .5) * (extents.max_y - extents.min_y) / SAMPLES;
+      points[k].x = points32[k].x;
+      points[k].y = points32[k].y;
+    }
+
+    widened.resize (num_endpoints);
+    for (unsigned int i = 0; i < num_endpoints; i++) {
+      widened[i].p.x = endpoints32[i].p.x;
+      widened[i].p.y = endpoints32[i].p.y;
+      widened[i].d = endpoints32[i].d;
+    }
+    glyphy_sdf_from_arc_list_batch (&widened[0], num_endpoints, &points[0], points.size (), &sdfs[0]);
+    glyphy_sdf_from_arc_list32_batch (&endpoints32[0], num_endpoints, &points32[0], points32.size (), &sdfs32[0]);
+
+    bool bad = false;
+    for (unsigned int k = 0; k < SAMPLES * SAMPLES; k++)
+    {
+      results.num_points++;
+
+      double sdf_diff = fabs (fabs (sdfs[k]) - fabs (sdfs32[k])) / tolerance;
+      results.max_sdf_diff = max (results.max_sdf_diff, sdf_diff);
+      if (sdf_diff > .01)
+	bad = true;
+      else if ((sdfs[k] < 0) != (sdfs32[k] < 0) && fabs (sdfs[k]) > sdf_diff * tolerance)
+      {
+	if (is_tie (widened, points[k], .01 * tolerance))
+	  results.ties++;
+	else
+	  bad = true;
+      }
+
+      if (fabs (sdfs[k]) <= 2 * tolerance)
+      {
+	double blob_diff = fabs (blob_sdf (&blob[0], nominal_width, nominal_height, extents, points[k]) -
+				 blob_sdf (&blob32[0], nominal_width32, nominal_height32, extents32, points[k])) / tolerance;
+	results.max_blob_diff = max (results.max_blob_diff, blob_diff);
+	if (blob_diff > 1)
+	  bad = true;
+      }
+    }
+    if (bad) {
+      fprintf (stderr, "glyph %u: float32 results out of tolerance\n", glyph_index);
+      results.bad_glyphs++;
+    }
+  }
+
+  glyphy_arc_accumulator_destroy (acc32);
+  glyphy_arc_accumulator_destroy (acc);
+}
+
+int
+main (int argc, char** argv)
+{
+  FT_Library ft_library;
+  FT_Init_FreeType (&ft_library);
+
+  results_t results = results_t ();
+  if (argc == 1)
+  {
+    FT_Face ft_face = NULL;
+    FT_New_Memory_Face (ft_library, (const FT_Byte *) default_font, sizeof (default_font), 0, &ft_face);
+    if (!ft_face)
+      die ("Failed to open default font");
+    check_face (ft_face, results);
+    FT_Done_Face (ft_face);
+  }
+  for (int arg = 1; arg < argc; arg++)
+  {
+    FT_Face ft_face = NULL;
+    FT_New_Face (ft_library, argv[arg], 0, &ft_face);
+    if (!ft_face)
+      die ("Failed to open font file");
+    check_face (ft_face, results);
+    FT_Done_Face (ft_face);
+  }
+
+  FT_Done_FreeType (ft_library);
+
+  printf ("%u glyphs, %u out of tolerance; %u blobs differ, by at most %.3g tolerances near the outline\n"
+	  "%lu points: float SDF within %.3g tolerances of double; %u ties\n",
+	  results.num_glyphs, results.bad_glyphs, results.differing_blobs, results.max_blob_diff,
+	  results.num_points, results.max_sdf_diff, results.ties);
+
+  return results.bad_glyphs ? 1 : 0;
+}
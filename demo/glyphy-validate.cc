@@ -28,8 +28,6 @@
 
 #include <glyphy-freetype.h>
 
-#include <vector>
-
 using namespace std;
 
 static inline void
@@ -39,14 +37,6 @@ die (const char *msg)
   exit (1);
 }
 
-static glyphy_bool_t
-accumulate_endpoint (glyphy_arc_endpoint_t         *endpoint,
-		     vector<glyphy_arc_endpoint_t> *endpoints)
-{
-  endpoints->push_back (*endpoint);
-  return true;
-}
-
 int
 main (int argc, char** argv)
 {
@@ -108,20 +98,19 @@ main (int argc, char** argv)
 
 	unsigned int upem = ft_face->units_per_EM;
 	double tolerance = upem * TOLERANCE; /* in font design units */
-	vector<glyphy_arc_endpoint_t> endpoints;
 
 	glyphy_arc_accumulator_reset (acc);
 	glyphy_arc_accumulator_set_tolerance (acc, tolerance);
-	glyphy_arc_accumulator_set_callback (acc,
-					     (glyphy_arc_endpoint_accumulator_callback_t) accumulate_endpoint,
-					     &endpoints);
 
 	if (FT_Err_Ok != glyphy_freetype(outline_decompose) (&ft_face->glyph->outline, acc))
 	  die ("Failed converting glyph outline to arcs");
 
+	unsigned int num_endpoints;
+	glyphy_arc_endpoint_t *endpoints = glyphy_arc_accumulator_get_endpoints (acc, &num_endpoints);
+
 	if (verbose) {
-	  printf ("Arc list has %d endpoints\n", (int) endpoints.size ());
-	  for (unsigned int i = 0; i < endpoints.size (); i++)
+	  printf ("Arc list has %d endpoints\n", num_endpoints);
+	  for (unsigned int i = 0; i < num_endpoints; i++)
 	    printf ("Endpoint %d: p=(%g,%g),d=%g\n", i, endpoints[i].p.x, endpoints[i].p.y, endpoints[i].d);
 	}
 
@@ -129,12 +118,12 @@ main (int argc, char** argv)
 
 #if 0
 	if (ft_face->glyph->outline.flags & FT_OUTLINE_EVEN_ODD_FILL)
-	  glyphy_outline_winding_from_even_odd (&endpoints[0], endpoints.size (), false);
+	  glyphy_outline_winding_from_even_odd (endpoints, num_endpoints, false);
 #endif
 	if (ft_face->glyph->outline.flags & FT_OUTLINE_REVERSE_FILL)
-	  glyphy_outline_reverse (&endpoints[0], endpoints.size ());
+	  glyphy_outline_reverse (endpoints, num_endpoints);
 
-	if (glyphy_outline_winding_from_even_odd (&endpoints[0], endpoints.size (), false))
+	if (glyphy_outline_winding_from_even_odd_parallel (endpoints, num_endpoints, false))
 	{
 	  fprintf (stderr, "ERROR: %s:%d: Glyph %d (%s) has contours with wrong direction\n",
 		   font_path, face_index, glyph_index, glyph_name);
@@ -76,7 +76,9 @@ template <class MaxDeviationApproximator>
 class ArcBezierErrorApproximatorBehdad
 {
   public:
-  static double approximate_bezier_arc_error (const Bezier &b0, const Arc &a)
+  /* The estimate doesn't depend on tolerance. */
+  static double approximate_bezier_arc_error (const Bezier &b0, const Arc &a,
+					      double /* tolerance */ = 0)
   {
     assert (b0.p0 == a.p0);
     assert (b0.p3 == a.p1);
@@ -130,6 +132,196 @@ class ArcBezierErrorApproximatorBehdad
 
 
 
+/* Tries a looser bound that's quicker to compute first, and only falls
+ * back to ArcBezierErrorApproximator if that bound is above tolerance. */
+template <class ArcBezierErrorApproximator>
+class ArcBezierErrorApproximatorTwoTier
+{
+  public:
+  static double approximate_bezier_arc_error (const Bezier &b0, const Arc &a,
+					      double tolerance = 0)
+  {
+    if (tolerance > 0)
+    {
+      double ea;
+      Bezier b1 = a.approximate_bezier (&ea);
+
+      /* The curves differ by 3t(1-t)((1-t)v₀ + t v₁), which is at most
+       * 3/4 max(|v₀|,|v₁|) and at most 4/9 (|v₀|+|v₁|). */
+      double l0 = (b1.p1 - b0.p1).len ();
+      double l1 = (b1.p2 - b0.p2).len ();
+      double e = ea + std::min (.75 * std::max (l0, l1), 4/9. * (l0 + l1));
+      if (e <= tolerance)
+	return e;
+    }
+
+    return ArcBezierErrorApproximator::approximate_bezier_arc_error (b0, a);
+  }
+};
+
+
+
+/* Measures the distance between curve and arc to within a fraction of a
+ * percent instead of estimating it.  Much slower, but lets longer arcs
+ * through; for offline use.  Falls back to ArcBezierErrorApproximator
+ * where the measurement doesn't bound the distance both ways. */
+template <class ArcBezierErrorApproximator>
+class ArcBezierErrorApproximatorMeasured
+{
+  struct Target
+  {
+    Arc arc;
+    bool straight;
+    Pair<Vector> tangents;
+    Vector u; /* p0 - center, or the chord's unit normal if straight */
+    double radius;
+
+    Target (const Arc &a) : arc (a), straight (fabs (a.d) < 1e-5),
+			    tangents (a.tangents ()), u (0, 0), radius (0)
+    {
+      if (straight) {
+	/* Drawn as the chord; see Arc::distance_to_point(). */
+	tangents = Pair<Vector> (a.p1 - a.p0, a.p1 - a.p0);
+	u = (a.p1 - a.p0).ortho ().normalized ();
+      } else {
+	u = a.p0 - a.center ();
+	radius = a.radius ();
+      }
+    }
+
+    double distance (const Point &p) const
+    {
+      if (straight)
+	return fabs (Segment (arc.p0, arc.p1).distance_to_point (p));
+      if (arc.wedge_contains_point (p))
+	return fabs ((p - arc.p0 + u).len () - radius);
+      return sqrt (std::min (p.squared_distance_to_point (arc.p0),
+			     p.squared_distance_to_point (arc.p1)));
+    }
+
+    /* Is p where the distance is to the inside of the arc, rather than
+     * to its ends?  That region is convex, except for wide arcs. */
+    bool inside (const Point &p) const
+    {
+      if (fabs (arc.d) > 1)
+	return false;
+      return (p - arc.p0) * tangents.first >= 0 && (p - arc.p1) * tangents.second <= 0;
+    }
+
+    /* Upper bound on the distance from s to the arc, if s is inside. */
+    double bound (const Bezier &s) const
+    {
+      const Point *p = &s.p0;
+      for (unsigned int i = 0; i < 4; i++)
+	if (!inside (p[i]))
+	  return GLYPHY_INFINITY;
+
+      const Vector q[4] = {p[0] - arc.p0, p[1] - arc.p0, p[2] - arc.p0, p[3] - arc.p0};
+
+      if (straight) {
+	double h = 0;
+	for (unsigned int i = 0; i < 4; i++)
+	  h = std::max (h, fabs (q[i] * u));
+	return h;
+      }
+
+      /* |s(t) - center|² - r² in the degree-six Bernstein basis; it is
+       * Σ qᵢ·qⱼ + (qᵢ + qⱼ)·u weighted over i + j = k. */
+      static const double w[4][4] = {
+	{1, .5, .2, .05},
+	{.5, .6, .45, .2},
+	{.2, .45, .6, .5},
+	{.05, .2, .5, 1},
+      };
+      double g = 0;
+      for (unsigned int k = 0; k <= 6; k++) {
+	double c = 0;
+	for (unsigned int i = k > 3 ? k - 3 : 0; i <= std::min (k, 3u); i++) {
+	  unsigned int j = k - i;
+	  c += w[i][j] * (q[i] * q[j] + (q[i] + q[j]) * u);
+	}
+	g = std::max (g, fabs (c));
+      }
+      if (g >= radius * radius)
+	return GLYPHY_INFINITY;
+      return g / (radius + sqrt (radius * radius - g));
+    }
+  };
+
+  struct Piece
+  {
+    glyphy_point_t p[4];
+    double e0, e1;
+    double upper;
+
+    Bezier bezier (void) const { return Bezier (p[0], p[1], p[2], p[3]); }
+    void set_bezier (const Bezier &b) { p[0] = b.p0; p[1] = b.p1; p[2] = b.p2; p[3] = b.p3; }
+  };
+
+  static void bound_piece (const Target &target, Piece &piece)
+  {
+    Bezier b = piece.bezier ();
+    /* The distance changes no faster than the point moves, which is at
+     * most 3 max|pᵢ₊₁-pᵢ| over the piece. */
+    double speed = 3 * std::max ((b.p1 - b.p0).len (),
+				 std::max ((b.p2 - b.p1).len (), (b.p3 - b.p2).len ()));
+    piece.upper = std::min (.5 * (piece.e0 + piece.e1 + speed), target.bound (b));
+  }
+
+  public:
+  static double approximate_bezier_arc_error (const Bezier &b0, const Arc &a,
+					      double tolerance = 0)
+  {
+    Target target (a);
+
+    /* Keep splitting the piece that could be farthest until that is
+     * hardly more than the farthest point found. */
+    const unsigned int max_pieces = 64;
+    Piece pieces[max_pieces];
+    unsigned int n = 1;
+    pieces[0].set_bezier (b0);
+    pieces[0].e0 = pieces[0].e1 = 0;
+    bound_piece (target, pieces[0]);
+
+    double lower = 0, upper;
+    double slack = 1e-6 * (a.p1 - a.p0).len ();
+    for (;;)
+    {
+      unsigned int worst = 0;
+      for (unsigned int i = 1; i < n; i++)
+	if (pieces[i].upper > pieces[worst].upper)
+	  worst = i;
+      upper = pieces[worst].upper;
+      if (upper <= lower * (1 + 1e-3) + slack || n == max_pieces)
+	break;
+
+      Pair<Bezier> halves = pieces[worst].bezier ().halve ();
+      double e = target.distance (halves.second.p0);
+      lower = std::max (lower, e);
+
+      Piece &left = pieces[worst];
+      Piece &right = pieces[n++];
+      right.set_bezier (halves.second);
+      right.e0 = e;
+      right.e1 = left.e1;
+      left.set_bezier (halves.first);
+      left.e1 = e;
+      bound_piece (target, left);
+      bound_piece (target, right);
+    }
+
+    /* The curve runs from one end of the arc to the other.  If it stays
+     * close enough to never reach the center nor loop around between the
+     * ends, it passes every point of the arc at that distance too. */
+    if (target.straight || (upper < target.radius && 2 * upper < (a.p1 - a.p0).len ()))
+      return upper;
+
+    return ArcBezierErrorApproximator::approximate_bezier_arc_error (b0, a, tolerance);
+  }
+};
+
+
+
 template <class ArcBezierErrorApproximator>
 class ArcBezierApproximatorMidpointSimple
 {
@@ -148,7 +340,8 @@ template <class ArcBezierErrorApproximator>
 class ArcBezierApproximatorMidpointTwoPart
 {
   public:
-  static const Arc approximate_bezier_with_arc (const Bezier &b, double *error, double mid_t = .5)
+  static const Arc approximate_bezier_with_arc (const Bezier &b, double *error, double mid_t = .5,
+					       double tolerance = 0)
   {
     Pair<Bezier > pair = b.split (mid_t);
     Point m = pair.second.p0;
@@ -156,71 +349,190 @@ class ArcBezierApproximatorMidpointTwoPart
     Arc a0 (b.p0, m, b.p3, true);
     Arc a1 (m, b.p3, b.p0, true);
 
-    double e0 = ArcBezierErrorApproximator::approximate_bezier_arc_error (pair.first, a0);
-    double e1 = ArcBezierErrorApproximator::approximate_bezier_arc_error (pair.second, a1);
+    double e0 = ArcBezierErrorApproximator::approximate_bezier_arc_error (pair.first, a0, tolerance);
+    double e1 = ArcBezierErrorApproximator::approximate_bezier_arc_error (pair.second, a1, tolerance);
     *error = std::max (e0, e1);
 
     return Arc (b.p0, b.p3, m, false);
   }
 };
 
+/* Size of the grid cells arc endpoints get rounded to later, as the
+ * blob encoder rounds them to its extents in 4095 steps.  Rounding moves
+ * an endpoint by at most half a cell on each axis, wherever the grid
+ * ends up. */
+struct EndpointGrid
+{
+  EndpointGrid (double step_x_ = 0, double step_y_ = 0) :
+    step_x (step_x_), step_y (step_y_) {}
+
+  double step_x, step_y;
+
+  /* How far rounding the ends of a can move it, keeping d.  That maps a
+   * onto the new arc by a similarity, which moves a point z by at most
+   * |z-p0|/|p1-p0| δ1 + |z-p1|/|p1-p0| δ0.  Along the arc, those add up
+   * to √(1+d²) at most, at its middle. */
+  inline double snap_error (const Arc &a) const
+  {
+    if (!step_x && !step_y)
+      return 0;
+    return .5 * hypot (step_x, step_y) * sqrt (1 + a.d * a.d);
+  }
+};
+
+/* Clamps d to max_d, then rounds it to one of 2^d_bits-1 steps. */
+static inline double quantize_d (double d, double max_d, unsigned int d_bits)
+{
+  if (isfinite (max_d)) {
+    assert (max_d >= 0);
+    if (fabs (d) > max_d)
+      d = d < 0 ? -max_d : max_d;
+  }
+  if (d_bits && max_d != 0) {
+    assert (isfinite (max_d));
+    assert (fabs (d) <= max_d);
+    int mult = (1 << (d_bits - 1)) - 1;
+    int id = round (d / max_d * mult);
+    assert (-mult <= id && id <= mult);
+    d = id * max_d / mult;
+    assert (fabs (d) <= max_d);
+  }
+  return d;
+}
+
 template <class ArcBezierErrorApproximator>
 class ArcBezierApproximatorQuantized
 {
   public:
-  ArcBezierApproximatorQuantized (double _max_d = GLYPHY_INFINITY, unsigned int _d_bits = 0) :
-    max_d (_max_d), d_bits (_d_bits) {};
+  /* Errors up to tolerance may be reported less tightly, if that's
+   * quicker; zero means always the tightest.  Errors include rounding
+   * the arc ends to grid. */
+  ArcBezierApproximatorQuantized (double _max_d = GLYPHY_INFINITY, unsigned int _d_bits = 0,
+				  double _tolerance = 0,
+				  const EndpointGrid &_grid = EndpointGrid ()) :
+    max_d (_max_d), d_bits (_d_bits), tolerance (_tolerance), grid (_grid) {};
 
   protected:
   double max_d;
   unsigned int d_bits;
+  double tolerance;
+  EndpointGrid grid;
+
+  /* Clamps and quantizes a.d; returns the error that introduces. */
+  double quantize (Arc &a) const
+  {
+    double orig_d = a.d;
+    a.d = quantize_d (a.d, max_d, d_bits);
+    return fabs (a.d - orig_d) * (a.p1 - a.p0).len () * .5;
+  }
 
   public:
   const Arc approximate_bezier_with_arc (const Bezier &b, double *error) const
   {
     double mid_t = .5;
     Arc a (b.p0, b.p3, b.point (mid_t), false);
-    Arc orig_a = a;
 
-    if (isfinite (max_d)) {
-      assert (max_d >= 0);
-      if (fabs (a.d) > max_d)
-        a.d = a.d < 0 ? -max_d : max_d;
-    }
-    if (d_bits && max_d != 0) {
-      assert (isfinite (max_d));
-      assert (fabs (a.d) <= max_d);
-      int mult = (1 << (d_bits - 1)) - 1;
-      int id = round (a.d / max_d * mult);
-      assert (-mult <= id && id <= mult);
-      a.d = id * max_d / mult;
-      assert (fabs (a.d) <= max_d);
-    }
-
-    /* Error introduced by arc quantization */
-    double ed = fabs (a.d - orig_a.d) * (a.p1 - a.p0).len () * .5;
+    /* Error introduced by arc quantization, and endpoint rounding */
+    double ed = quantize (a);
+    double es = grid.snap_error (a);
 
     ArcBezierApproximatorMidpointTwoPart<ArcBezierErrorApproximator>
-	    ::approximate_bezier_with_arc (b, error, mid_t);
+	    ::approximate_bezier_with_arc (b, error, mid_t, tolerance - ed - es);
 
     if (ed) {
       *error += ed;
 
       /* Try a simple one-arc approx which works with the quantized arc.
-       * May produce smaller error bound. */
-      double e = ArcBezierErrorApproximator::approximate_bezier_arc_error (b, a);
-      if (e < *error)
-        *error = e;
+       * May produce smaller error bound.  No need if within tolerance. */
+      if (!(*error + es <= tolerance)) {
+	double e = ArcBezierErrorApproximator::approximate_bezier_arc_error (b, a, tolerance - es);
+	if (e < *error)
+	  *error = e;
+      }
+    }
+    *error += es;
+
+    return a;
+  }
+};
+
+/* For Béziers that are degree-elevated quadratics, as TrueType curves
+ * are.  Makes the same arc as ArcBezierApproximatorQuantized but bounds
+ * its error in closed form, falling back to that class where the bound
+ * doesn't hold. */
+template <class ArcBezierErrorApproximator>
+class ArcBezierApproximatorQuantizedQuadratic : public ArcBezierApproximatorQuantized<ArcBezierErrorApproximator>
+{
+  typedef ArcBezierApproximatorQuantized<ArcBezierErrorApproximator> Base;
+
+  public:
+  ArcBezierApproximatorQuantizedQuadratic (double _max_d = GLYPHY_INFINITY, unsigned int _d_bits = 0,
+					   double _tolerance = 0,
+					   const EndpointGrid &_grid = EndpointGrid ()) :
+    Base (_max_d, _d_bits, _tolerance, _grid) {};
+
+  /* Max distance between the quadratic p0,c,p2 and arc a, which must go
+   * through p0, p2, and the curve's midpoint.  Negative if we can't tell.
+   *
+   * With C and r the arc's center and radius, f(t) = |Q(t)-C|² - r² is a
+   * quartic with roots at 0, ½, and 1, so it is t(1-t)(2t-1)(αt+β).  The
+   * cubic factor peaks at 1/(6√3), the linear one at either end.  A point
+   * with |f| ≤ F is then within F / (r + √(r²-F)) of the circle.  If c is
+   * in the wedge, so is the whole curve, and it maps onto the arc. */
+  static double approximate_quadratic_arc_error (const Point &p0, const Point &c, const Point &p2,
+						 const Arc &a)
+  {
+    if (a.d * a.d > 1. - 1e-4)
+      return -1;
+    if (!a.wedge_contains_point (c))
+      return -1;
+
+    /* Distance to the chord; that's what arcs this flat are drawn as. */
+    if (fabs (a.d) < 1e-5) {
+      double l = (p2 - p0).len ();
+      return l ? fabs ((c - p0).cross (p2 - p0)) / l * .5 : -1;
     }
 
+    Vector u = p0 - a.center ();
+    Vector A = (p0 - c) + (p2 - c);
+    double alpha = -.5 * (A * A);
+    double beta = -4 * (u * (c - p0));
+    double F = std::max (fabs (beta), fabs (alpha + beta)) * (1 / (6 * sqrt (3.)));
+
+    double r = a.radius ();
+    if (F >= r * r)
+      return -1;
+    return F / (r + sqrt (r * r - F));
+  }
+
+  const Arc approximate_bezier_with_arc (const Bezier &b, double *error) const
+  {
+    /* Undo the degree elevation. */
+    Point c = b.p0.midpoint (b.p3) + (b.p1 - b.p0) * .75 + (b.p2 - b.p3) * .75;
+
+    Arc a (b.p0, b.p3, b.point (.5), false);
+    double e = approximate_quadratic_arc_error (b.p0, c, b.p3, a);
+    if (e < 0)
+      return Base::approximate_bezier_with_arc (b, error);
+
+    /* Error introduced by arc quantization, and endpoint rounding */
+    *error = e + this->quantize (a);
+    *error += this->grid.snap_error (a);
+
     return a;
   }
 };
 
 typedef MaxDeviationApproximatorExact MaxDeviationApproximatorDefault;
+/* ArcBezierErrorApproximatorTwoTier<...> here is quicker per arc, but
+ * the looser errors it reports make jiggling settle on worse splits,
+ * costing more arcs and more time overall. */
 typedef ArcBezierErrorApproximatorBehdad<MaxDeviationApproximatorDefault> ArcBezierErrorApproximatorDefault;
 typedef ArcBezierApproximatorMidpointTwoPart<ArcBezierErrorApproximatorDefault> ArcBezierApproximatorDefault;
 typedef ArcBezierApproximatorQuantized<ArcBezierErrorApproximatorDefault> ArcBezierApproximatorQuantizedDefault;
+typedef ArcBezierApproximatorQuantizedQuadratic<ArcBezierErrorApproximatorDefault> ArcBezierApproximatorQuantizedQuadraticDefault;
+typedef ArcBezierErrorApproximatorMeasured<ArcBezierErrorApproximatorDefault> ArcBezierErrorApproximatorMeasuredDefault;
+typedef ArcBezierApproximatorQuantized<ArcBezierErrorApproximatorMeasuredDefault> ArcBezierApproximatorQuantizedMeasuredDefault;
 
 } /* namespace ArcBezier */
 } /* namespace GLyphy */
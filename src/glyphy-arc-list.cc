@@ -0,0 +1,288 @@
+/*
+ * Copyright 2012 Google, Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Google Author(s): Behdad Esfahbod
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "glyphy-arc-list.hh"
+
+using namespace GLyphy::Geometry;
+using namespace GLyphy::ArcList;
+
+
+/*
+ * Arc tree
+ */
+
+#define LEAF_SIZE 4
+
+struct CompareCenters
+{
+  const std::vector<PreparedArc> &arcs;
+  bool vertical;
+
+  CompareCenters (const std::vector<PreparedArc> &arcs_, bool vertical_) :
+    arcs (arcs_), vertical (vertical_) {}
+
+  bool operator () (unsigned int a, unsigned int b) const
+  {
+    const glyphy_extents_t &ea = arcs[a].extents;
+    const glyphy_extents_t &eb = arcs[b].extents;
+    return vertical ? ea.min_y + ea.max_y < eb.min_y + eb.max_y
+		    : ea.min_x + ea.max_x < eb.min_x + eb.max_x;
+  }
+};
+
+unsigned int
+ArcTree::build_node (const std::vector<PreparedArc> &arcs,
+		     unsigned int first, unsigned int count)
+{
+  unsigned int index = nodes.size ();
+  nodes.push_back (Node ());
+
+  glyphy_extents_t extents;
+  glyphy_extents_clear (&extents);
+  for (unsigned int i = first; i < first + count; i++)
+    glyphy_extents_extend (&extents, &arcs[order[i]].extents);
+  nodes[index].extents = extents;
+
+  if (count <= LEAF_SIZE) {
+    nodes[index].first = first;
+    nodes[index].count = count;
+    return index;
+  }
+
+  /* Split at the median of arc centers along the longer side. */
+  bool vertical = extents.max_y - extents.min_y > extents.max_x - extents.min_x;
+  unsigned int half = count / 2;
+  std::nth_element (order.begin () + first,
+		    order.begin () + first + half,
+		    order.begin () + first + count,
+		    CompareCenters (arcs, vertical));
+
+  build_node (arcs, first, half); /* at index + 1 */
+  unsigned int right = build_node (arcs, first + half, count - half);
+  nodes[index].first = right;
+  nodes[index].count = 0;
+  return index;
+}
+
+void
+ArcTree::build (const std::vector<PreparedArc> &arcs)
+{
+  nodes.clear ();
+  order.resize (arcs.size ());
+  for (unsigned int i = 0; i < arcs.size (); i++)
+    order[i] = i;
+  if (arcs.size ())
+    build_node (arcs, 0, arcs.size ());
+}
+
+static inline bool
+extents_intersect (const glyphy_extents_t &a, const glyphy_extents_t &b)
+{
+  return a.min_x <= b.max_x && b.min_x <= a.max_x &&
+	 a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+void
+ArcTree::query (const std::vector<PreparedArc> &arcs,
+		const glyphy_extents_t &box,
+		std::vector<unsigned int> &indices) const
+{
+  indices.clear ();
+  if (nodes.empty ())
+    return;
+
+  unsigned int stack[64];
+  unsigned int depth = 0;
+  stack[depth++] = 0;
+  while (depth)
+  {
+    unsigned int index = stack[--depth];
+    const Node &node = nodes[index];
+    if (!extents_intersect (node.extents, box))
+      continue;
+    if (node.count) {
+      for (unsigned int i = node.first; i < node.first + node.count; i++)
+	if (extents_intersect (arcs[order[i]].extents, box))
+	  indices.push_back (order[i]);
+    } else {
+      stack[depth++] = node.first;
+      stack[depth++] = index + 1;
+    }
+  }
+  std::sort (indices.begin (), indices.end ());
+}
+
+static inline double
+extents_distance (const glyphy_extents_t &e, const Point &p)
+{
+  double dx = std::max (0., std::max (e.min_x - p.x, p.x - e.max_x));
+  double dy = std::max (0., std::max (e.min_y - p.y, p.y - e.max_y));
+  return hypot (dx, dy);
+}
+
+double
+ArcTree::nearest_endpoint_distance (const std::vector<PreparedArc> &arcs,
+				    const Point &p) const
+{
+  double best = GLYPHY_INFINITY;
+  if (nodes.empty ())
+    return best;
+
+  unsigned int stack[64];
+  unsigned int depth = 0;
+  stack[depth++] = 0;
+  while (depth)
+  {
+    unsigned int index = stack[--depth];
+    const Node &node = nodes[index];
+    if (extents_distance (node.extents, p) >= best)
+      continue;
+    if (node.count) {
+      for (unsigned int i = node.first; i < node.first + node.count; i++) {
+	const Arc &a = arcs[order[i]].arc;
+	best = std::min (best, std::min ((a.p0 - p).len (), (a.p1 - p).len ()));
+      }
+    } else {
+      /* Visit the nearer child first. */
+      unsigned int left = index + 1, right = node.first;
+      if (extents_distance (nodes[left].extents, p) < extents_distance (nodes[right].extents, p))
+	std::swap (left, right);
+      stack[depth++] = left;
+      stack[depth++] = right;
+    }
+  }
+  return best;
+}
+
+
+/*
+ * Prepared arc list
+ */
+
+void
+glyphy_arc_list_t::prepare (void)
+{
+  arcs.clear ();
+  glyphy_extents_clear (&extents);
+
+  Point p0 (0, 0);
+  for (unsigned int i = 0; i < endpoints.size (); i++) {
+    const glyphy_arc_endpoint_t &endpoint = endpoints[i];
+    if (endpoint.d == GLYPHY_INFINITY) {
+      p0 = endpoint.p;
+      continue;
+    }
+    arcs.push_back (PreparedArc (Arc (p0, endpoint.p, endpoint.d), i));
+    p0 = endpoint.p;
+
+    glyphy_extents_extend (&extents, &arcs.back ().extents);
+  }
+
+  tree.build (arcs);
+}
+
+void
+glyphy_arc_list_t::update (unsigned int start, unsigned int end)
+{
+  /* Arcs are in endpoint order.  Redo the ones that touch the changed
+   * endpoints, which includes the one starting at the last of them. */
+  end = std::min (end + 1, (unsigned int) endpoints.size ());
+  unsigned int k = 0;
+  while (k < arcs.size () && arcs[k].endpoint < start)
+    k++;
+  for (unsigned int i = start; i < end; i++) {
+    const glyphy_arc_endpoint_t &endpoint = endpoints[i];
+    if (endpoint.d == GLYPHY_INFINITY)
+      continue;
+    if (k == arcs.size () || arcs[k].endpoint != i) {
+      /* Move-tos changed; start over. */
+      prepare ();
+      return;
+    }
+    Point p0 = i ? Point (endpoints[i - 1].p) : Point (0, 0);
+    arcs[k++] = PreparedArc (Arc (p0, endpoint.p, endpoint.d), i);
+  }
+
+  glyphy_extents_clear (&extents);
+  for (unsigned int i = 0; i < arcs.size (); i++)
+    glyphy_extents_extend (&extents, &arcs[i].extents);
+
+  tree.build (arcs);
+}
+
+glyphy_arc_list_t *
+glyphy_arc_list_create (const glyphy_arc_endpoint_t *endpoints,
+			unsigned int                 num_endpoints)
+{
+  glyphy_arc_list_t *arc_list = new glyphy_arc_list_t;
+  arc_list->refcount = 1;
+
+  arc_list->endpoints.assign (endpoints, endpoints + num_endpoints);
+  arc_list->prepare ();
+
+  return arc_list;
+}
+
+glyphy_arc_list_t *
+glyphy_arc_list_create32 (const glyphy_arc_endpoint32_t *endpoints,
+			  unsigned int                   num_endpoints)
+{
+  glyphy_arc_list_t *arc_list = new glyphy_arc_list_t;
+  arc_list->refcount = 1;
+
+  endpoints_from_32 (endpoints, num_endpoints, arc_list->endpoints);
+  arc_list->prepare ();
+
+  return arc_list;
+}
+
+void
+glyphy_arc_list_destroy (glyphy_arc_list_t *arc_list)
+{
+  if (!arc_list || --arc_list->refcount)
+    return;
+
+  delete arc_list;
+}
+
+glyphy_arc_list_t *
+glyphy_arc_list_reference (glyphy_arc_list_t *arc_list)
+{
+  if (arc_list)
+    arc_list->refcount++;
+  return arc_list;
+}
+
+const glyphy_arc_endpoint_t *
+glyphy_arc_list_get_endpoints (glyphy_arc_list_t *arc_list,
+			       unsigned int      *num_endpoints)
+{
+  *num_endpoints = arc_list->endpoints.size ();
+  return arc_list->endpoints.size () ? &arc_list->endpoints[0] : NULL;
+}
+
+void
+glyphy_arc_list_get_extents (glyphy_arc_list_t *arc_list,
+			     glyphy_extents_t  *extents)
+{
+  *extents = arc_list->extents;
+}
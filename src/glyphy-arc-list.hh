@@ -0,0 +1,159 @@
+/*
+ * Copyright 2012 Google, Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Google Author(s): Behdad Esfahbod
+ */
+
+#ifndef GLYPHY_ARC_LIST_HH
+#define GLYPHY_ARC_LIST_HH
+
+#include "glyphy-common.hh"
+#include "glyphy-geometry.hh"
+
+namespace GLyphy {
+namespace ArcList {
+
+using namespace Geometry;
+
+
+/* An arc with everything the SDF, extents and winding code derive from
+ * it computed once.  Calculations mirror the Arc methods they replace,
+ * so results are identical. */
+struct PreparedArc
+{
+  Arc arc;
+  unsigned int endpoint; /* index of the endpoint this arc ends at */
+
+  Pair<Vector> tangents;
+  bool wide; /* |d| > 1; wedge is the union of the half-planes */
+  bool straight; /* |d| < 1e-5; distance is to the segment */
+
+  /* Curved arcs */
+  Point center;
+  double radius;
+
+  /* Straight arcs: Line (p0, p1), and its normal length */
+  Vector n;
+  double c;
+  double nlen;
+
+  /* Extended distance */
+  Point m;
+  Vector q, n0, n1;
+
+  glyphy_extents_t extents;
+
+  PreparedArc (const Arc &a, unsigned int endpoint_) :
+    arc (a), endpoint (endpoint_),
+    tangents (a.tangents ()),
+    center (0, 0), radius (0),
+    n (0, 0), c (0), nlen (1),
+    m (a.p0.lerp (.5, a.p1)), q (a.p1 - m), n0 (0, 0), n1 (0, 0)
+  {
+    wide = fabs (a.d) > 1;
+    straight = fabs (a.d) < 1e-5;
+    if (straight) {
+      if (a.p0 != a.p1) {
+	Line l (a.p0, a.p1);
+	n = l.n;
+	c = l.c;
+	nlen = l.n.len ();
+      }
+    } else {
+      center = a.center ();
+      radius = a.radius ();
+    }
+
+    Vector dp = a.p1 - a.p0;
+    Vector pp = dp.ortho ();
+    float d2 = tan2atan (a.d);
+    n0 = (pp + dp * d2).normalized ();
+    n1 = (pp - dp * d2).normalized ();
+
+    a.extents (extents);
+  }
+
+  inline bool wedge_contains_point (const Point &p) const
+  {
+    if (!wide)
+      return (p - arc.p0) * tangents.first  >= 0 && (p - arc.p1) * tangents.second <= 0;
+    else
+      return (p - arc.p0) * tangents.first  >= 0 || (p - arc.p1) * tangents.second <= 0;
+  }
+
+  inline double extended_dist (double x, double y) const
+  {
+    if ((x - m.x) * q.dx + (y - m.y) * q.dy < 0)
+      return (x - arc.p0.x) * n0.dx + (y - arc.p0.y) * n0.dy;
+    else
+      return (x - arc.p1.x) * n1.dx + (y - arc.p1.y) * n1.dy;
+  }
+};
+
+
+/* Bounding-box hierarchy over the arcs.  Leaves hold a few arcs each;
+ * queries report arc indices in ascending order, which is the order the
+ * SDF and winding code need to see them in. */
+struct ArcTree
+{
+  struct Node
+  {
+    glyphy_extents_t extents;
+    unsigned int first; /* into order[] for leaves; first child otherwise */
+    unsigned int count; /* zero for inner nodes, which have two children */
+  };
+
+  std::vector<Node> nodes;
+  std::vector<unsigned int> order;
+
+  void build (const std::vector<PreparedArc> &arcs);
+
+  /* Arcs whose extents intersect box. */
+  void query (const std::vector<PreparedArc> &arcs,
+	      const glyphy_extents_t &box,
+	      std::vector<unsigned int> &indices) const;
+
+  /* Distance from p to the closest arc endpoint, or infinity. */
+  double nearest_endpoint_distance (const std::vector<PreparedArc> &arcs,
+				    const Point &p) const;
+
+  private:
+  unsigned int build_node (const std::vector<PreparedArc> &arcs,
+			   unsigned int first, unsigned int count);
+};
+
+} /* namespace ArcList */
+} /* namespace GLyphy */
+
+
+struct glyphy_arc_list_t
+{
+  unsigned int refcount;
+
+  std::vector<glyphy_arc_endpoint_t> endpoints;
+  std::vector<GLyphy::ArcList::PreparedArc> arcs;
+  GLyphy::ArcList::ArcTree tree;
+  glyphy_extents_t extents;
+
+  /* Arcs near the points being queried; kept so queries don't allocate. */
+  std::vector<unsigned int> indices;
+
+  /* Recomputes everything from endpoints. */
+  void prepare (void);
+  /* Same, after endpoints in [start, end) changed in place. */
+  void update (unsigned int start, unsigned int end);
+};
+
+#endif /* GLYPHY_ARC_LIST_HH */
@@ -29,6 +29,39 @@ namespace ArcsBezier {
 using namespace Geometry;
 using namespace ArcBezier;
 
+/* Work done by ArcsBezierApproximatorSpringSystem, for tuning. */
+struct ArcsBezierApproximatorCounters
+{
+  ArcsBezierApproximatorCounters (void) :
+    calc_arcs (0), jiggles (0), jiggle_overflows (0), degenerate (0), max_n (0) {}
+
+  void add (const ArcsBezierApproximatorCounters &other)
+  {
+    calc_arcs += other.calc_arcs;
+    jiggles += other.jiggles;
+    jiggle_overflows += other.jiggle_overflows;
+    degenerate += other.degenerate;
+    max_n = std::max (max_n, other.max_n);
+  }
+
+  unsigned int calc_arcs;
+  unsigned int jiggles;
+  unsigned int jiggle_overflows; /* jiggling stopped before settling */
+  unsigned int degenerate; /* curves with no area */
+  unsigned int max_n; /* most arcs tried on a curve */
+};
+
+/* Buffers ArcsBezierApproximatorSpringSystem works in.  Passing the same
+ * one in for every curve saves allocating them over and over.  Results
+ * are copied between them, never swapped, so each one only ever grows. */
+struct ArcsBezierApproximatorScratch
+{
+  std::vector<double> t;
+  std::vector<double> e;
+  std::vector<Arc> arcs;
+  std::vector<Arc> piece_arcs;
+};
+
 template <class ArcBezierApproximator>
 class ArcsBezierApproximatorSpringSystem
 {
@@ -37,8 +70,10 @@ class ArcsBezierApproximatorSpringSystem
 				const ArcBezierApproximator &appx,
 				std::vector<double> &e,
 				std::vector<Arc > &arcs,
-				double &max_e, double &min_e)
+				double &max_e, double &min_e,
+				ArcsBezierApproximatorCounters &counters)
   {
+    counters.calc_arcs++;
     unsigned int n = t.size () - 1;
     e.resize (n);
     arcs.clear ();
@@ -61,7 +96,7 @@ class ArcsBezierApproximatorSpringSystem
 			     std::vector<Arc > &arcs,
 			     double &max_e, double &min_e,
 			     double tolerance,
-			     unsigned int &n_jiggle)
+			     ArcsBezierApproximatorCounters &counters)
   {
     unsigned int n = t.size () - 1;
     double conditioner = tolerance * .01;
@@ -84,15 +119,83 @@ class ArcsBezierApproximatorSpringSystem
       }
       t[n] = 1.0; // Do this to get real 1.0, not .9999999999999998!
 
-      calc_arcs (b, t, appx, e, arcs, max_e, min_e);
+      calc_arcs (b, t, appx, e, arcs, max_e, min_e, counters);
 
       //fprintf (stderr, "n %d jiggle %d max_e %g min_e %g\n", n, s, max_e, min_e);
 
-      n_jiggle++;
+      counters.jiggles++;
       if (max_e < tolerance || (2 * min_e - max_e > tolerance))
 	break;
     }
-    //if (s == max_jiggle) fprintf (stderr, "JIGGLE OVERFLOW n %d s %d\n", n, s);
+    if (s == max_jiggle)
+      counters.jiggle_overflows++;
+  }
+
+  /* Approximates b with n arcs, spaced uniformly and then jiggled. */
+  static inline void try_n (const Bezier &b,
+			    unsigned int n,
+			    double tolerance,
+			    const ArcBezierApproximator &appx,
+			    std::vector<double> &t,
+			    std::vector<double> &e,
+			    std::vector<Arc> &arcs,
+			    double &max_e,
+			    ArcsBezierApproximatorCounters &counters)
+  {
+    double min_e;
+
+    counters.max_n = std::max (counters.max_n, n);
+    t.resize (n + 1);
+    for (unsigned int i = 0; i < n; i++)
+      t[i] = double (i) / n;
+    t[n] = 1.0; // Do this out of the loop to get real 1.0, not .9999999999999998!
+
+    calc_arcs (b, t, appx, e, arcs, max_e, min_e, counters);
+
+    for (unsigned int i = 0; i < n; i++)
+      if (e[i] <= tolerance) {
+	jiggle (b, appx, t, e, arcs, max_e, min_e, tolerance, counters);
+	break;
+      }
+  }
+
+  /* Parameters in (0,1) where b switches between turning left and right,
+   * in increasing order.  Returns how many there are. */
+  static inline unsigned int find_inflections (const Bezier &b, double t[2])
+  {
+    /* B'(t) × B''(t) is proportional to qa t² + qb t + qc. */
+    Vector v1 = b.p1 - b.p0;
+    Vector v2 = (b.p2 - b.p1) - v1;
+    Vector v3 = (b.p3 - b.p2) - (b.p2 - b.p1) - v2;
+    double qa = v2.cross (v3);
+    double qb = v1.cross (v3);
+    double qc = v1.cross (v2);
+
+    double roots[2];
+    unsigned int num_roots = 0;
+    if (qa == 0) {
+      if (qb != 0)
+	roots[num_roots++] = -qc / qb;
+    } else {
+      double delta = qb * qb - 4 * qa * qc;
+      /* A double root touches zero without changing sign. */
+      if (delta > 0) {
+	double q = -.5 * (qb + (qb < 0 ? -sqrt (delta) : sqrt (delta)));
+	roots[num_roots++] = q / qa;
+	if (q != 0)
+	  roots[num_roots++] = qc / q;
+	if (num_roots == 2 && roots[0] > roots[1])
+	  std::swap (roots[0], roots[1]);
+      }
+    }
+
+    /* Splitting off a sliver would cost an arc and buy nothing. */
+    const double margin = 1e-3;
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < num_roots; i++)
+      if (roots[i] > margin && roots[i] < 1 - margin)
+	t[n++] = roots[i];
+    return n;
   }
 
   public:
@@ -101,7 +204,65 @@ class ArcsBezierApproximatorSpringSystem
 					    const ArcBezierApproximator &appx,
 					    std::vector<Arc> &arcs,
 					    double *perror,
-					    unsigned int max_segments = 100)
+					    unsigned int max_segments = 100,
+					    ArcsBezierApproximatorCounters *pcounters = NULL,
+					    ArcsBezierApproximatorScratch *pscratch = NULL)
+  {
+    ArcsBezierApproximatorScratch local_scratch;
+    ArcsBezierApproximatorScratch &scratch = pscratch ? *pscratch : local_scratch;
+
+    /* Arcs fit poorly across an inflection, driving n up; fit the
+     * pieces on either side separately instead.  Curvature extrema are
+     * not split at: within a piece that turns one way, jiggling already
+     * moves arc boundaries to where the error is. */
+    double splits[4];
+    unsigned int num_pieces = 1 + find_inflections (b, splits + 1);
+    if (num_pieces == 1) {
+      approximate_piece (b, tolerance, appx, arcs, perror, max_segments, pcounters, scratch);
+      return;
+    }
+
+    splits[0] = 0;
+    splits[num_pieces] = 1;
+    double max_e = 0;
+    arcs.clear ();
+    for (unsigned int i = 0; i < num_pieces; i++)
+    {
+      double e;
+      approximate_piece (b.segment (splits[i], splits[i + 1]), tolerance, appx,
+			 scratch.piece_arcs, &e, max_segments, pcounters, scratch);
+      arcs.insert (arcs.end (), scratch.piece_arcs.begin (), scratch.piece_arcs.end ());
+      max_e = std::max (max_e, e);
+    }
+
+    /* When only a few arcs are needed, being forced to break at the
+     * inflections can cost more than it saves.  See if the whole curve
+     * fits in fewer arcs then.  Only searching below the split result
+     * keeps that cheap. */
+    if (arcs.size () > 1 && arcs.size () <= 16)
+    {
+      double e;
+      approximate_piece (b, tolerance, appx, scratch.piece_arcs, &e, arcs.size () - 1, pcounters, scratch, false);
+      if (e <= tolerance) {
+	arcs.assign (scratch.piece_arcs.begin (), scratch.piece_arcs.end ());
+	max_e = e;
+      }
+    }
+
+    if (perror)
+      *perror = max_e;
+  }
+
+  private:
+  static void approximate_piece (const Bezier &b,
+				 double tolerance,
+				 const ArcBezierApproximator &appx,
+				 std::vector<Arc> &arcs,
+				 double *perror,
+				 unsigned int max_segments,
+				 ArcsBezierApproximatorCounters *pcounters,
+				 ArcsBezierApproximatorScratch &scratch,
+				 bool search_all = true)
   {
     /* Handle fully-degenerate cases. */
     Vector v1 (b.p1 - b.p0);
@@ -114,36 +275,66 @@ class ArcsBezierApproximatorSpringSystem
       arcs.clear ();
       if (b.p0 != b.p1)
 	arcs.push_back (Arc (b.p0, b.p1, 0));
+      if (perror)
+	*perror = 0;
+      if (pcounters)
+	pcounters->degenerate++;
       return;
     }
 
-    std::vector<double> t;
-    std::vector<double> e;
-    double max_e, min_e;
-    unsigned int n_jiggle = 0;
+    ArcsBezierApproximatorCounters counters;
+    std::vector<double> &t = scratch.t;
+    std::vector<double> &e = scratch.e;
+    std::vector<Arc> &best_arcs = scratch.arcs;
+    double max_e, best_e = 0;
 
-    /* Technically speaking we can bsearch for n. */
-    for (unsigned int n = 1; n <= max_segments; n++)
+    /* Find the smallest n that meets the tolerance.  Error goes down
+     * roughly as n^-ORDER, so each try suggests where the smallest n is;
+     * that guess is kept strictly between the largest n known to fail
+     * and the smallest one known to pass.  As with trying every n in
+     * turn, if no n up to max_segments meets the tolerance, we end up
+     * with max_segments arcs. */
+    const double error_order = 3;
+    unsigned int lo = 0, hi = max_segments + 1; /* largest failing, smallest passing */
+    unsigned int n = 1;
+    for (;;)
     {
-      t.resize (n + 1);
-      for (unsigned int i = 0; i < n; i++)
-        t[i] = double (i) / n;
-      t[n] = 1.0; // Do this out of the loop to get real 1.0, not .9999999999999998!
+      try_n (b, n, tolerance, appx, t, e, arcs, max_e, counters);
+      if (max_e <= tolerance) {
+	hi = n;
+	best_arcs.assign (arcs.begin (), arcs.end ());
+	best_e = max_e;
+      } else
+	lo = n;
 
-      calc_arcs (b, t, appx, e, arcs, max_e, min_e);
+      if (hi - lo <= 1)
+	break;
 
-      for (unsigned int i = 0; i < n; i++)
-	if (e[i] <= tolerance) {
-	  jiggle (b, appx, t, e, arcs, max_e, min_e, tolerance, n_jiggle);
+      double guess = ceil (n * pow (max_e / tolerance, 1. / error_order));
+      n = guess <= lo ? lo + 1 : guess >= hi ? hi - 1 : (unsigned int) guess;
+    }
+    if (hi <= max_segments)
+    {
+      arcs.assign (best_arcs.begin (), best_arcs.end ());
+      max_e = best_e;
+    }
+    else if (search_all)
+    {
+      /* Error is not strictly monotonic in n, and once in a while the
+       * guesses jump over the only n that work.  Try them all then.
+       * Without search_all, the result is left over the tolerance. */
+      for (n = 1; n <= max_segments; n++)
+      {
+	try_n (b, n, tolerance, appx, t, e, arcs, max_e, counters);
+	if (max_e <= tolerance)
 	  break;
-	}
-
-      if (max_e <= tolerance)
-        break;
+      }
     }
+
     if (perror)
       *perror = max_e;
-    //fprintf (stderr, "n_jiggle %d\n", n_jiggle);
+    if (pcounters)
+      pcounters->add (counters);
   }
 };
 
@@ -24,6 +24,10 @@
 #include "glyphy-geometry.hh"
 #include "glyphy-arcs-bezier.hh"
 
+#ifdef GLYPHY_ACCUMULATOR_TIMING
+#include <time.h>
+#endif
+
 using namespace GLyphy::Geometry;
 using namespace GLyphy::ArcsBezier;
 
@@ -33,6 +37,11 @@ using namespace GLyphy::ArcsBezier;
  * Approximate outlines with multiple arcs
  */
 
+#define NO_CONTOUR ((unsigned int) -1)
+
+/* With simplify, curves are fit this much tighter, leaving the rest of
+ * the tolerance for merging arcs. */
+#define SIMPLIFY_FIT_FRACTION .125
 
 struct glyphy_arc_accumulator_t {
   unsigned int refcount;
@@ -40,29 +49,61 @@ struct glyphy_arc_accumulator_t {
   double tolerance;
   double max_d;
   unsigned int d_bits;
+  bool measure_error;
+  bool record_contours;
+  bool simplify;
+  EndpointGrid grid;
   glyphy_arc_endpoint_accumulator_callback_t  callback;
   void                                       *user_data;
+  glyphy_arc_endpoint_t                      *buffer;
+  glyphy_arc_endpoint32_t                    *buffer32;
+  unsigned int                                buffer_size;
 
   glyphy_point_t start_point;
   glyphy_point_t current_point;
   bool           need_moveto;
   unsigned int   num_endpoints;
   double max_error;
+  unsigned int contour_start; /* of the contour to simplify, if any */
+  double contour_error;
   glyphy_bool_t success;
+  glyphy_arc_accumulator_stats_t stats;
+  ArcsBezierApproximatorCounters counters;
+
+  /* Kept across curves and resets, to not allocate for every curve. */
+  std::vector<Arc> arcs;
+  std::vector<Arc> level_arcs;
+  ArcsBezierApproximatorScratch scratch;
+
+  /* Extra levels of detail, each accumulating at its own tolerance. */
+  std::vector<glyphy_arc_accumulator_t *> lods;
+  std::vector<glyphy_arc_accumulator_t *> levels;
+
+  /* Output when there's neither a callback nor a buffer. */
+  std::vector<glyphy_arc_endpoint_t> endpoints;
+
+  std::vector<glyphy_contour_t> contours;
 };
 
 
 glyphy_arc_accumulator_t *
 glyphy_arc_accumulator_create (void)
 {
-  glyphy_arc_accumulator_t *acc = (glyphy_arc_accumulator_t *) calloc (1, sizeof (glyphy_arc_accumulator_t));
+  glyphy_arc_accumulator_t *acc = new glyphy_arc_accumulator_t;
   acc->refcount = 1;
 
   acc->tolerance = 5e-4;
   acc->max_d = GLYPHY_MAX_D;
   acc->d_bits = 8;
+  acc->measure_error = false;
+  acc->record_contours = false;
+  acc->simplify = false;
+  acc->grid = EndpointGrid ();
   acc->callback = NULL;
   acc->user_data = NULL;
+  acc->buffer = NULL;
+  acc->buffer32 = NULL;
+  acc->buffer_size = 0;
 
   glyphy_arc_accumulator_reset (acc);
 
@@ -76,7 +117,16 @@ glyphy_arc_accumulator_reset (glyphy_arc_accumulator_t *acc)
   acc->need_moveto = true;
   acc->num_endpoints = 0;
   acc->max_error = 0;
+  acc->contour_start = NO_CONTOUR;
+  acc->contour_error = 0;
   acc->success = true;
+  acc->endpoints.clear ();
+  acc->contours.clear ();
+  memset (&acc->stats, 0, sizeof (acc->stats));
+  acc->counters = ArcsBezierApproximatorCounters ();
+
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_reset (acc->lods[i]);
 }
 
 void
@@ -85,7 +135,9 @@ glyphy_arc_accumulator_destroy (glyphy_arc_accumulator_t *acc)
   if (!acc || --acc->refcount)
     return;
 
-  free (acc);
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_destroy (acc->lods[i]);
+  delete acc;
 }
 
 glyphy_arc_accumulator_t *
@@ -119,6 +171,9 @@ glyphy_arc_accumulator_set_callback (glyphy_arc_accumulator_t *acc,
 {
   acc->callback = callback;
   acc->user_data = user_data;
+  acc->buffer = NULL;
+  acc->buffer32 = NULL;
+  acc->buffer_size = 0;
 }
 
 void
@@ -130,6 +185,30 @@ glyphy_arc_accumulator_get_callback (glyphy_arc_accumulator_t  *acc,
   *user_data = acc->user_data;
 }
 
+void
+glyphy_arc_accumulator_set_buffer (glyphy_arc_accumulator_t *acc,
+				   glyphy_arc_endpoint_t    *buffer,
+				   unsigned int              buffer_size)
+{
+  acc->callback = NULL;
+  acc->user_data = NULL;
+  acc->buffer = buffer;
+  acc->buffer32 = NULL;
+  acc->buffer_size = buffer ? buffer_size : 0;
+}
+
+void
+glyphy_arc_accumulator_set_buffer32 (glyphy_arc_accumulator_t *acc,
+				     glyphy_arc_endpoint32_t  *buffer,
+				     unsigned int              buffer_size)
+{
+  acc->callback = NULL;
+  acc->user_data = NULL;
+  acc->buffer = NULL;
+  acc->buffer32 = buffer;
+  acc->buffer_size = buffer ? buffer_size : 0;
+}
+
 void
 glyphy_arc_accumulator_set_d_metrics (glyphy_arc_accumulator_t *acc,
 				      double                    max_d,
@@ -137,6 +216,8 @@ glyphy_arc_accumulator_set_d_metrics (glyphy_arc_accumulator_t *acc,
 {
   acc->max_d = max_d;
   acc->d_bits = d_bits;
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_set_d_metrics (acc->lods[i], max_d, d_bits);
 }
 
 void
@@ -148,6 +229,110 @@ glyphy_arc_accumulator_get_d_metrics (glyphy_arc_accumulator_t *acc,
   *d_bits = acc->d_bits;
 }
 
+void
+glyphy_arc_accumulator_set_measure_error (glyphy_arc_accumulator_t *acc,
+					  glyphy_bool_t             measure_error)
+{
+  acc->measure_error = measure_error;
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_set_measure_error (acc->lods[i], measure_error);
+}
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_measure_error (glyphy_arc_accumulator_t *acc)
+{
+  return acc->measure_error;
+}
+
+void
+glyphy_arc_accumulator_set_record_contours (glyphy_arc_accumulator_t *acc,
+					    glyphy_bool_t             record_contours)
+{
+  acc->record_contours = record_contours;
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_set_record_contours (acc->lods[i], record_contours);
+}
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_record_contours (glyphy_arc_accumulator_t *acc)
+{
+  return acc->record_contours;
+}
+
+void
+glyphy_arc_accumulator_set_simplify (glyphy_arc_accumulator_t *acc,
+				     glyphy_bool_t             simplify)
+{
+  acc->simplify = simplify;
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_set_simplify (acc->lods[i], simplify);
+}
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_simplify (glyphy_arc_accumulator_t *acc)
+{
+  return acc->simplify;
+}
+
+void
+glyphy_arc_accumulator_set_snap_grid (glyphy_arc_accumulator_t *acc,
+				      const glyphy_extents_t   *extents,
+				      unsigned int              steps)
+{
+  if (extents && steps && !glyphy_extents_is_empty (extents))
+    acc->grid = EndpointGrid ((extents->max_x - extents->min_x) / steps,
+			      (extents->max_y - extents->min_y) / steps);
+  else
+    acc->grid = EndpointGrid ();
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_set_snap_grid (acc->lods[i], extents, steps);
+}
+
+void
+glyphy_arc_accumulator_get_snap_grid (glyphy_arc_accumulator_t *acc,
+				      double                   *step_x,
+				      double                   *step_y)
+{
+  *step_x = acc->grid.step_x;
+  *step_y = acc->grid.step_y;
+}
+
+void
+glyphy_arc_accumulator_set_lod_tolerances (glyphy_arc_accumulator_t *acc,
+					   const double             *tolerances,
+					   unsigned int              num_levels)
+{
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    glyphy_arc_accumulator_destroy (acc->lods[i]);
+  acc->lods.clear ();
+
+  for (unsigned int i = 0; i < num_levels; i++)
+  {
+    glyphy_arc_accumulator_t *lod = glyphy_arc_accumulator_create ();
+    lod->tolerance = tolerances[i];
+    lod->max_d = acc->max_d;
+    lod->d_bits = acc->d_bits;
+    lod->measure_error = acc->measure_error;
+    lod->record_contours = acc->record_contours;
+    lod->simplify = acc->simplify;
+    lod->grid = acc->grid;
+    acc->lods.push_back (lod);
+  }
+}
+
+unsigned int
+glyphy_arc_accumulator_get_num_lods (glyphy_arc_accumulator_t *acc)
+{
+  return acc->lods.size ();
+}
+
+glyphy_arc_accumulator_t *
+glyphy_arc_accumulator_get_lod (glyphy_arc_accumulator_t *acc,
+				unsigned int              level)
+{
+  return level < acc->lods.size () ? acc->lods[level] : NULL;
+}
+
 
 /* Accumulation results */
 
@@ -169,15 +354,94 @@ glyphy_arc_accumulator_successful (glyphy_arc_accumulator_t *acc)
   return acc->success;
 }
 
+void
+glyphy_arc_accumulator_get_stats (glyphy_arc_accumulator_t       *acc,
+				  glyphy_arc_accumulator_stats_t *stats)
+{
+  *stats = acc->stats;
+  stats->num_calc_arcs = acc->counters.calc_arcs;
+  stats->num_jiggles = acc->counters.jiggles;
+  stats->num_jiggle_overflows = acc->counters.jiggle_overflows;
+  stats->num_degenerate = acc->counters.degenerate;
+  stats->max_n = acc->counters.max_n;
+}
+
+glyphy_contour_t *
+glyphy_arc_accumulator_get_contours (glyphy_arc_accumulator_t *acc,
+				     unsigned int             *num_contours)
+{
+  *num_contours = acc->contours.size ();
+  return acc->contours.size () ? &acc->contours[0] : NULL;
+}
+
+glyphy_arc_endpoint_t *
+glyphy_arc_accumulator_get_endpoints (glyphy_arc_accumulator_t *acc,
+				      unsigned int             *num_endpoints)
+{
+  if (acc->callback || acc->buffer32) {
+    *num_endpoints = 0;
+    return NULL;
+  }
+  *num_endpoints = acc->num_endpoints;
+  if (acc->buffer)
+    return acc->buffer;
+  return acc->endpoints.size () ? &acc->endpoints[0] : NULL;
+}
+
 
 /* Accumulate */
 
+/* Same sums as winding() and glyphy_arc_list_extents() do, one endpoint
+ * at a time. */
+static void
+record_contour (glyphy_arc_accumulator_t *acc, const glyphy_arc_endpoint_t &endpoint)
+{
+  if (endpoint.d == GLYPHY_INFINITY) {
+    glyphy_contour_t contour = glyphy_contour_t ();
+    contour.start = acc->num_endpoints;
+    contour.num_endpoints = 1;
+    glyphy_extents_clear (&contour.extents);
+    acc->contours.push_back (contour);
+    return;
+  }
+
+  glyphy_contour_t &contour = acc->contours.back ();
+  const Point p0 = acc->current_point;
+  const Point p1 = endpoint.p;
+  contour.num_endpoints++;
+  contour.area += Vector (p0).cross (Vector (p1));
+  contour.area -= .5 * endpoint.d * (p1 - p0).len2 ();
+
+  glyphy_extents_t arc_extents;
+  Arc (p0, p1, endpoint.d).extents (arc_extents);
+  glyphy_extents_extend (&contour.extents, &arc_extents);
+}
+
 static void
 emit (glyphy_arc_accumulator_t *acc, const Point &p, double d)
 {
   glyphy_arc_endpoint_t endpoint = {p, d};
-  acc->success = acc->success && acc->callback (&endpoint, acc->user_data);
+  if (!acc->success)
+    return;
+  if (acc->callback)
+    acc->success = acc->callback (&endpoint, acc->user_data);
+  else if (acc->buffer) {
+    acc->success = acc->num_endpoints < acc->buffer_size;
+    if (acc->success)
+      acc->buffer[acc->num_endpoints] = endpoint;
+  } else if (acc->buffer32) {
+    acc->success = acc->num_endpoints < acc->buffer_size;
+    if (acc->success) {
+      glyphy_arc_endpoint32_t &endpoint32 = acc->buffer32[acc->num_endpoints];
+      endpoint32.p.x = endpoint.p.x;
+      endpoint32.p.y = endpoint.p.y;
+      endpoint32.d = endpoint.d;
+    }
+  } else
+    acc->endpoints.push_back (endpoint);
   if (acc->success) {
+    if (acc->record_contours)
+      record_contour (acc, endpoint);
     acc->num_endpoints++;
     acc->current_point = p;
   }
@@ -199,6 +463,8 @@ accumulate (glyphy_arc_accumulator_t *acc, const Point &p, double d)
     if (acc->success) {
       acc->start_point = acc->current_point;
       acc->need_moveto = false;
+      acc->contour_start = acc->num_endpoints - 1;
+      acc->contour_error = 0;
     }
   }
   emit (acc, p, d);
@@ -211,28 +477,144 @@ move_to (glyphy_arc_accumulator_t *acc, const Point &p)
     accumulate (acc, p, GLYPHY_INFINITY);
 }
 
+/* Merges runs of arcs in the contour just closed, within what its arcs'
+ * own error leaves of the tolerance.  A contour is only simplified once,
+ * so merged arcs are never merged again. */
 static void
-arc_to (glyphy_arc_accumulator_t *acc, const Point &p1, double d)
+simplify_contour (glyphy_arc_accumulator_t *acc)
 {
-  accumulate (acc, p1, d);
+  unsigned int start = acc->contour_start;
+  if (start == NO_CONTOUR || !acc->success || acc->callback || acc->buffer32)
+    return;
+  acc->contour_start = NO_CONTOUR;
+
+  glyphy_arc_endpoint_t *endpoints = acc->buffer ? acc->buffer : &acc->endpoints[0];
+  double e;
+  unsigned int n = start + glyphy_outline_simplify (endpoints + start, acc->num_endpoints - start,
+						    acc->tolerance - acc->contour_error,
+						    acc->max_d, acc->d_bits, &e);
+  if (n == acc->num_endpoints)
+    return;
+  acc->max_error = std::max (acc->max_error, acc->contour_error + e);
+  acc->num_endpoints = n;
+  if (!acc->buffer)
+    acc->endpoints.resize (n);
+
+  if (acc->record_contours) {
+    acc->contours.pop_back ();
+    for (acc->num_endpoints = start; acc->num_endpoints < n; acc->num_endpoints++) {
+      record_contour (acc, endpoints[acc->num_endpoints]);
+      acc->current_point = endpoints[acc->num_endpoints].p;
+    }
+  }
 }
 
+/* e is how far the arc is from what it approximates. */
 static void
-bezier (glyphy_arc_accumulator_t *acc, const Bezier &b)
+arc_to (glyphy_arc_accumulator_t *acc, const Point &p1, double d, double e = 0)
 {
-  double e;
+  if (acc->grid.step_x || acc->grid.step_y)
+    e = std::max (e, acc->grid.snap_error (Arc (acc->current_point, p1, d)));
+  acc->max_error = std::max (acc->max_error, e);
+  accumulate (acc, p1, d);
+  acc->contour_error = std::max (acc->contour_error, e);
+  if (acc->simplify && p1 == Point (acc->start_point))
+    simplify_contour (acc);
+}
 
-  std::vector<Arc> arcs;
-  typedef ArcBezierApproximatorQuantizedDefault _ArcBezierApproximator;
-  _ArcBezierApproximator appx (acc->max_d, acc->d_bits);
+#ifdef GLYPHY_ACCUMULATOR_TIMING
+/* Adds the time until it goes out of scope to total. */
+struct ScopedTimer
+{
+  ScopedTimer (unsigned long long &total_) : total (total_), start (now ()) {}
+  ~ScopedTimer (void) { total += now () - start; }
+
+  static unsigned long long now (void)
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  unsigned long long &total;
+  unsigned long long start;
+};
+#endif
+
+static inline double
+fit_tolerance (const glyphy_arc_accumulator_t *acc)
+{
+  return acc->simplify ? acc->tolerance * SIMPLIFY_FIT_FRACTION : acc->tolerance;
+}
+
+template <class _ArcBezierApproximator>
+static void
+approximate (glyphy_arc_accumulator_t *acc, const Bezier &b,
+	     std::vector<Arc> &arcs, double *e,
+	     ArcsBezierApproximatorCounters *counters)
+{
+  double tolerance = fit_tolerance (acc);
+  _ArcBezierApproximator appx (acc->max_d, acc->d_bits, tolerance, acc->grid);
   ArcsBezierApproximatorSpringSystem<_ArcBezierApproximator>
-    ::approximate_bezier_with_arcs (b, acc->tolerance, appx, arcs, &e);
+    ::approximate_bezier_with_arcs (b, tolerance, appx, arcs, e,
+				    100, counters, &acc->scratch);
+}
 
+static void
+bezier_arcs_to (glyphy_arc_accumulator_t *acc, const Bezier &b,
+		const std::vector<Arc> &arcs, double e)
+{
   acc->max_error = std::max (acc->max_error, e);
 
   move_to (acc, b.p0);
   for (unsigned int i = 0; i < arcs.size (); i++)
-    arc_to (acc, arcs[i].p1, arcs[i].d);
+    arc_to (acc, arcs[i].p1, arcs[i].d, e);
+}
+
+static bool
+coarser (const glyphy_arc_accumulator_t *a, const glyphy_arc_accumulator_t *b)
+{
+  return a->tolerance > b->tolerance;
+}
+
+template <class _ArcBezierApproximator>
+static void
+bezier (glyphy_arc_accumulator_t *acc, const Bezier &b)
+{
+  double e;
+
+#ifdef GLYPHY_ACCUMULATOR_TIMING
+  ScopedTimer timer (acc->stats.nanoseconds);
+#endif
+
+  std::vector<Arc> &arcs = acc->arcs;
+  if (acc->lods.empty ()) {
+    approximate<_ArcBezierApproximator> (acc, b, arcs, &e, &acc->counters);
+    bezier_arcs_to (acc, b, arcs, e);
+    return;
+  }
+
+  /* Go from the coarsest level to the finest.  Arcs that meet one
+   * level's tolerance often meet the next one's too; pass them on then. */
+  std::vector<glyphy_arc_accumulator_t *> &levels = acc->levels;
+  levels.assign (1, acc);
+  levels.insert (levels.end (), acc->lods.begin (), acc->lods.end ());
+  /* Stable, like std::stable_sort, but without its temporary buffer;
+   * there are only a few levels. */
+  for (unsigned int i = 1; i < levels.size (); i++)
+    for (unsigned int j = i; j && coarser (levels[j], levels[j - 1]); j--)
+      std::swap (levels[j], levels[j - 1]);
+
+  e = GLYPHY_INFINITY;
+  for (unsigned int i = 0; i < levels.size (); i++)
+  {
+    glyphy_arc_accumulator_t *level = levels[i];
+    if (!(e <= fit_tolerance (level))) {
+      approximate<_ArcBezierApproximator> (level, b, acc->level_arcs, &e, &acc->counters);
+      arcs.assign (acc->level_arcs.begin (), acc->level_arcs.end ());
+    }
+    bezier_arcs_to (level, b, arcs, e);
+  }
 }
 
 static void
@@ -247,13 +629,18 @@ glyphy_arc_accumulator_move_to (glyphy_arc_accumulator_t *acc,
 				const glyphy_point_t *p0)
 {
   move_to (acc, *p0);
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    move_to (acc->lods[i], *p0);
 }
 
 void
 glyphy_arc_accumulator_line_to (glyphy_arc_accumulator_t *acc,
 				const glyphy_point_t *p1)
 {
+  acc->stats.num_lines++;
   arc_to (acc, *p1, 0);
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    arc_to (acc->lods[i], *p1, 0);
 }
 
 void
@@ -261,10 +648,15 @@ glyphy_arc_accumulator_conic_to (glyphy_arc_accumulator_t *acc,
 				 const glyphy_point_t *p1,
 				 const glyphy_point_t *p2)
 {
-  bezier (acc, Bezier (acc->current_point,
-		       Point (acc->current_point).lerp (2/3., *p1),
-		       Point (*p2).lerp (2/3., *p1),
-		       *p2));
+  acc->stats.num_conics++;
+  Bezier b (acc->current_point,
+	    Point (acc->current_point).lerp (2/3., *p1),
+	    Point (*p2).lerp (2/3., *p1),
+	    *p2);
+  if (acc->measure_error)
+    bezier<ArcBezierApproximatorQuantizedMeasuredDefault> (acc, b);
+  else
+    bezier<ArcBezierApproximatorQuantizedQuadraticDefault> (acc, b);
 }
 
 void
@@ -273,7 +665,12 @@ glyphy_arc_accumulator_cubic_to (glyphy_arc_accumulator_t *acc,
 				 const glyphy_point_t *p2,
 				 const glyphy_point_t *p3)
 {
-  bezier (acc, Bezier (acc->current_point, *p1, *p2, *p3));
+  acc->stats.num_cubics++;
+  Bezier b (acc->current_point, *p1, *p2, *p3);
+  if (acc->measure_error)
+    bezier<ArcBezierApproximatorQuantizedMeasuredDefault> (acc, b);
+  else
+    bezier<ArcBezierApproximatorQuantizedDefault> (acc, b);
 }
 
 void
@@ -281,13 +678,18 @@ glyphy_arc_accumulator_arc_to (glyphy_arc_accumulator_t *acc,
 			       const glyphy_point_t *p1,
 			       double         d)
 {
+  acc->stats.num_arcs++;
   arc_to (acc, *p1, d);
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    arc_to (acc->lods[i], *p1, d);
 }
 
 void
 glyphy_arc_accumulator_close_path (glyphy_arc_accumulator_t *acc)
 {
   close_path (acc);
+  for (unsigned int i = 0; i < acc->lods.size (); i++)
+    close_path (acc->lods[i]);
 }
 
 
@@ -318,3 +720,13 @@ glyphy_arc_list_extents (const glyphy_arc_endpoint_t *endpoints,
     glyphy_extents_extend (extents, &arc_extents);
   }
 }
+
+void
+glyphy_contour_list_extents (const glyphy_contour_t *contours,
+			     unsigned int            num_contours,
+			     glyphy_extents_t       *extents)
+{
+  glyphy_extents_clear (extents);
+  for (unsigned int i = 0; i < num_contours; i++)
+    glyphy_extents_extend (extents, &contours[i].extents);
+}
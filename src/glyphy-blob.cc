@@ -23,7 +23,10 @@
 #include "glyphy-common.hh"
 #include "glyphy-geometry.hh"
 
-#define GRID_SIZE 24
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 using namespace GLyphy::Geometry;
 
@@ -34,6 +37,9 @@ using namespace GLyphy::Geometry;
 #define MAX_X 4095
 #define MAX_Y 4095
 
+/* Nominal grid size is passed to the shader in 6 bits */
+#define MAX_GRID_SIZE 63
+
 static inline glyphy_rgba_t
 arc_endpoint_encode (unsigned int ix, unsigned int iy, double d)
 {
@@ -61,6 +67,9 @@ arc_endpoint_encode (unsigned int ix, unsigned int iy, double d)
 static inline glyphy_rgba_t
 arc_list_encode (unsigned int offset, unsigned int num_points, int side)
 {
+  assert (offset < 65536);
+  assert (num_points < 255); /* 255 marks an empty inside cell */
+
   glyphy_rgba_t v;
   v.r = 0; // unused for arc-list encoding
   v.g = UPPER_BITS (offset, 8, 16);
@@ -98,104 +107,370 @@ line_encode (const Line &line)
 }
 
 
+/* Uniform bucket grid over the arcs of an outline.
+ *
+ * Each arc is filed in every bucket its extents overlap.  Queries return
+ * a superset of the arcs that can be within a given distance of a point,
+ * in outline order, such that running the exact per-arc tests on just
+ * those arcs gives bit-identical results to running them on all arcs.
+ *
+ * Can be rebuilt for another outline, reusing its buffers.
+ */
+struct ArcGrid
+{
+  ArcGrid (void) : origin (0, 0) {}
+
+  void build (const glyphy_arc_endpoint_t *endpoints,
+	      unsigned int                 num_endpoints,
+	      const glyphy_extents_t      &extents)
+  {
+    origin = Point (extents.min_x, extents.min_y);
+    arcs.clear ();
+    arcs_extents.clear ();
+    arcs_first_bucket.clear ();
+
+    Point p0 (0, 0);
+    for (unsigned int i = 0; i < num_endpoints; i++) {
+      const glyphy_arc_endpoint_t &endpoint = endpoints[i];
+      if (endpoint.d == GLYPHY_INFINITY) {
+	p0 = endpoint.p;
+	continue;
+      }
+      Arc arc (p0, endpoint.p, endpoint.d);
+      p0 = endpoint.p;
+
+      glyphy_extents_t arc_extents;
+      arc.extents (arc_extents);
+      arcs.push_back (arc);
+      arcs_extents.push_back (arc_extents);
+    }
+
+    grid_w = grid_h = std::max (1, std::min (64, (int) ceil (sqrt ((double) arcs.size ()))));
+    bucket_w = std::max ((extents.max_x - extents.min_x) / grid_w, GLYPHY_EPSILON);
+    bucket_h = std::max ((extents.max_y - extents.min_y) / grid_h, GLYPHY_EPSILON);
+
+    /* Count, then fill; buckets are stored back to back. */
+    bucket_start.assign (grid_w * grid_h + 1, 0);
+    for (unsigned int pass = 0; pass < 2; pass++)
+    {
+      for (unsigned int i = 0; i < arcs.size (); i++)
+      {
+	const glyphy_extents_t &e = arcs_extents[i];
+	unsigned int x0 = bucket_x (e.min_x), x1 = bucket_x (e.max_x);
+	unsigned int y0 = bucket_y (e.min_y), y1 = bucket_y (e.max_y);
+	if (pass == 0)
+	  arcs_first_bucket.push_back (Pair<unsigned int> (x0, y0));
+	for (unsigned int y = y0; y <= y1; y++)
+	  for (unsigned int x = x0; x <= x1; x++)
+	    if (pass == 0)
+	      bucket_start[y * grid_w + x + 1]++;
+	    else
+	      bucket_arcs[fill[y * grid_w + x]++] = i;
+      }
+      if (pass == 0)
+      {
+	for (unsigned int b = 0; b < grid_w * grid_h; b++)
+	  bucket_start[b + 1] += bucket_start[b];
+	bucket_arcs.resize (bucket_start[grid_w * grid_h]);
+	fill.assign (bucket_start.begin (), bucket_start.end () - 1);
+      }
+    }
+  }
+
+  /* Arcs that may be closest to p, in the sense of glyphy_sdf_from_arc_list(). */
+  void nearest_arcs (const Point &p, std::vector<unsigned int> &indices) const
+  {
+    /* Any endpoint distance bounds the minimum distance from above.  Find
+     * one by walking rings of buckets outward from p. */
+    double bound = GLYPHY_INFINITY;
+    int cx = bucket_x (p.x), cy = bucket_y (p.y);
+    int max_ring = std::max (grid_w, grid_h);
+    for (int ring = 0; ring <= max_ring && bound == GLYPHY_INFINITY; ring++)
+      for (int y = cy - ring; y <= cy + ring; y++)
+	for (int x = cx - ring; x <= cx + ring; x++)
+	{
+	  if (x < 0 || y < 0 || x >= (int) grid_w || y >= (int) grid_h)
+	    continue;
+	  if (std::max (abs (x - cx), abs (y - cy)) != ring)
+	    continue;
+	  unsigned int b = y * grid_w + x;
+	  for (unsigned int j = bucket_start[b]; j < bucket_start[b + 1]; j++) {
+	    const Arc &arc = arcs[bucket_arcs[j]];
+	    bound = std::min (bound, std::min ((arc.p0 - p).len (), (arc.p1 - p).len ()));
+	  }
+	}
+
+    arcs_within (p, bound, indices);
+  }
+
+  /* Arcs that may be within distance radius of p. */
+  void arcs_within (const Point &p, double radius, std::vector<unsigned int> &indices) const
+  {
+    indices.clear ();
+    if (radius == GLYPHY_INFINITY) {
+      for (unsigned int i = 0; i < arcs.size (); i++)
+	indices.push_back (i);
+      return;
+    }
+
+    /* Per-arc distances carry a (1 - GLYPHY_EPSILON) fudge and rounding
+     * error; pad generously so we never lose a candidate. */
+    radius += (radius + 1) * (2 * GLYPHY_EPSILON);
+
+    unsigned int x0 = bucket_x (p.x - radius), x1 = bucket_x (p.x + radius);
+    unsigned int y0 = bucket_y (p.y - radius), y1 = bucket_y (p.y + radius);
+    for (unsigned int y = y0; y <= y1; y++)
+      for (unsigned int x = x0; x <= x1; x++)
+      {
+	unsigned int b = y * grid_w + x;
+	for (unsigned int j = bucket_start[b]; j < bucket_start[b + 1]; j++)
+	{
+	  unsigned int i = bucket_arcs[j];
+
+	  /* Arcs spanning several buckets are only reported from the
+	   * first one of those that we visit. */
+	  if (x != std::max (x0, arcs_first_bucket[i].first) ||
+	      y != std::max (y0, arcs_first_bucket[i].second))
+	    continue;
+
+	  const glyphy_extents_t &e = arcs_extents[i];
+	  double dx = std::max (0., std::max (e.min_x - p.x, p.x - e.max_x));
+	  double dy = std::max (0., std::max (e.min_y - p.y, p.y - e.max_y));
+	  if (dx * dx + dy * dy <= radius * radius)
+	    indices.push_back (i);
+	}
+      }
+
+    std::sort (indices.begin (), indices.end ());
+  }
+
+  const Arc &arc (unsigned int i) const { return arcs[i]; }
+
+  /* Appends the given arcs to endpoints as an arc list. */
+  void to_endpoints (const std::vector<unsigned int> &indices,
+		     std::vector<glyphy_arc_endpoint_t> &endpoints) const
+  {
+    Point p1 (0, 0);
+    for (unsigned int i = 0; i < indices.size (); i++)
+    {
+      const Arc &arc = arcs[indices[i]];
+
+      if (i == 0 || p1 != arc.p0) {
+	glyphy_arc_endpoint_t endpoint = {arc.p0, GLYPHY_INFINITY};
+	endpoints.push_back (endpoint);
+	p1 = arc.p0;
+      }
+
+      glyphy_arc_endpoint_t endpoint = {arc.p1, arc.d};
+      endpoints.push_back (endpoint);
+      p1 = arc.p1;
+    }
+  }
+
+  private:
+  unsigned int bucket_x (double x) const
+  {
+    double v = floor ((x - origin.x) / bucket_w);
+    return v <= 0 ? 0 : v >= grid_w - 1 ? grid_w - 1 : (unsigned int) v;
+  }
+  unsigned int bucket_y (double y) const
+  {
+    double v = floor ((y - origin.y) / bucket_h);
+    return v <= 0 ? 0 : v >= grid_h - 1 ? grid_h - 1 : (unsigned int) v;
+  }
+
+  std::vector<Arc> arcs;
+  std::vector<glyphy_extents_t> arcs_extents;
+  std::vector<Pair<unsigned int> > arcs_first_bucket;
+
+  Point origin;
+  unsigned int grid_w, grid_h;
+  double bucket_w, bucket_h;
+  std::vector<unsigned int> bucket_start;
+  std::vector<unsigned int> bucket_arcs;
+  std::vector<unsigned int> fill;
+};
+
+
 /* Given a cell, fills the vector closest_arcs with arcs that may be closest to some point in the cell.
  * Uses idea that all close arcs to cell must be ~close to center of cell.
  */
 static void
 closest_arcs_to_cell (Point c0, Point c1, /* corners */
 		      double faraway,
-		      const glyphy_arc_endpoint_t *endpoints,
-		      unsigned int num_endpoints,
+		      const ArcGrid &grid,
+		      std::vector<unsigned int> &indices,
 		      std::vector<glyphy_arc_endpoint_t> &near_endpoints,
 		      int *side)
 {
   // Find distance between cell center
   Point c = c0.midpoint (c1);
-  double min_dist = glyphy_sdf_from_arc_list (endpoints, num_endpoints, &c, NULL);
+  grid.nearest_arcs (c, indices);
+  grid.to_endpoints (indices, near_endpoints);
+  double min_dist = glyphy_sdf_from_arc_list (near_endpoints.size () ? &near_endpoints[0] : NULL,
+					      near_endpoints.size (), &c, NULL);
+  near_endpoints.clear ();
+  indices.clear ();
 
   *side = min_dist >= 0 ? +1 : -1;
   min_dist = fabs (min_dist);
-  std::vector<Arc> near_arcs;
 
   // If d is the distance from the center of the square to the nearest arc, then
   // all nearest arcs to the square must be at most almost [d + half_diagonal] from the center.
   double half_diagonal = (c - c0).len ();
   double radius_squared = pow (min_dist + half_diagonal, 2);
   if (min_dist - half_diagonal <= faraway) {
-    Point p0 (0, 0);
-    for (unsigned int i = 0; i < num_endpoints; i++) {
-      const glyphy_arc_endpoint_t &endpoint = endpoints[i];
-      if (endpoint.d == GLYPHY_INFINITY) {
-	p0 = endpoint.p;
-	continue;
-      }
-      Arc arc (p0, endpoint.p, endpoint.d);
-      p0 = endpoint.p;
+    grid.arcs_within (c, min_dist + half_diagonal, indices);
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < indices.size (); i++)
+      if (grid.arc (indices[i]).squared_distance_to_point (c) <= radius_squared)
+        indices[count++] = indices[i];
+    indices.resize (count);
+  }
 
-      if (arc.squared_distance_to_point (c) <= radius_squared)
-        near_arcs.push_back (arc);
-    }
+  grid.to_endpoints (indices, near_endpoints);
+}
+
+
+/* Chained hash over the encoded arc-list area of a blob, for finding a
+ * run of endpoints that is already encoded.
+ *
+ * Position p is keyed on the last three bytes of texel p (the d byte of
+ * a run's first endpoint is ignored) plus all of texel p + 1.  Chains
+ * are kept in increasing position order, so the first hit is the same
+ * one a linear scan would find.
+ */
+struct EncodedRunIndex
+{
+  EncodedRunIndex (void) :
+    start (0), end (0),
+    head (NUM_BUCKETS, NONE), tail (NUM_BUCKETS, NONE) {}
+
+  /* Forgets all runs, to index a new area starting at start_. */
+  void reset (unsigned int start_)
+  {
+    start = end = start_;
+    head.assign (NUM_BUCKETS, NONE);
+    tail.assign (NUM_BUCKETS, NONE);
+    next.clear ();
   }
 
-  Point p1 = Point (0, 0);
-  for (unsigned i = 0; i < near_arcs.size (); i++)
+  /* Indexes the runs that became fully available when the encoded area
+   * grew to [start, new_end). */
+  void grow (const std::vector<glyphy_rgba_t> &tex_data, unsigned int new_end)
   {
-    Arc arc = near_arcs[i];
+    for (; end + 1 < new_end; end++)
+    {
+      unsigned int b = bucket (&tex_data[end]);
+      next.push_back (NONE);
+      if (tail[b] == NONE)
+	head[b] = end;
+      else
+	next[tail[b] - start] = end;
+      tail[b] = end;
+    }
+  }
 
-    if (i == 0 || p1 != arc.p0) {
-      glyphy_arc_endpoint_t endpoint = {arc.p0, GLYPHY_INFINITY};
-      near_endpoints.push_back (endpoint);
-      p1 = arc.p0;
+  /* Returns the first position in [start, limit) where needle is encoded,
+   * or NONE. */
+  unsigned int find (const std::vector<glyphy_rgba_t> &tex_data,
+		     unsigned int limit,
+		     const glyphy_rgba_t *needle,
+		     unsigned int needle_len) const
+  {
+    if (needle_len < 2) {
+      for (unsigned int p = start; p + needle_len <= limit; p++)
+	if (matches (&tex_data[p], needle, needle_len))
+	  return p;
+      return NONE;
     }
 
-    glyphy_arc_endpoint_t endpoint = {arc.p1, arc.d};
-    near_endpoints.push_back (endpoint);
-    p1 = arc.p1;
+    for (unsigned int p = head[bucket (needle)];
+	 p != NONE && p + needle_len <= limit;
+	 p = next[p - start])
+      if (matches (&tex_data[p], needle, needle_len))
+	return p;
+    return NONE;
   }
-}
 
+  static const unsigned int NONE = (unsigned int) -1;
 
-glyphy_bool_t
-glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
-			     unsigned int                 num_endpoints,
-			     glyphy_rgba_t               *blob,
-			     unsigned int                 blob_size,
-			     double                       faraway,
-			     double                       avg_fetch_desired,
-			     double                      *avg_fetch_achieved,
-			     unsigned int                *output_len,
-			     unsigned int                *nominal_width,  /* 8bit */
-			     unsigned int                *nominal_height, /* 8bit */
-			     glyphy_extents_t            *pextents)
-{
-  glyphy_extents_t extents;
-  glyphy_extents_clear (&extents);
+  private:
+  static const unsigned int NUM_BUCKETS = 1 << 12;
 
-  glyphy_arc_list_extents (endpoints, num_endpoints, &extents);
+  static unsigned int bucket (const glyphy_rgba_t *v)
+  {
+    unsigned int h = (v[0].g << 16) | (v[0].b << 8) | v[0].a;
+    h = h * 2654435761u ^ ((v[1].r << 24) | (v[1].g << 16) | (v[1].b << 8) | v[1].a);
+    h *= 2654435761u;
+    return h >> (32 - 12);
+  }
 
-  if (glyphy_extents_is_empty (&extents)) {
-    *pextents = extents;
-    if (!blob_size)
-      return false;
-    *blob = arc_list_encode (0, 0, +1);
-    *avg_fetch_achieved = 1;
-    *output_len = 1;
-    *nominal_width = *nominal_height = 1;
-    return true;
+  static bool matches (const glyphy_rgba_t *haystack,
+		       const glyphy_rgba_t *needle,
+		       unsigned int needle_len)
+  {
+    /* Trick: we don't care about first endpoint's d value, so skip one
+     * byte in comparison.  This works because arc_encode() packs the
+     * d value in the first byte. */
+    return 0 == memcmp (1 + (const char *) needle,
+			1 + (const char *) haystack,
+			needle_len * sizeof (*needle) - 1);
   }
 
-  /* Add antialiasing padding */
-  extents.min_x -= faraway;
-  extents.min_y -= faraway;
-  extents.max_x += faraway;
-  extents.max_y += faraway;
+  unsigned int start, end;
+  std::vector<unsigned int> head, tail, next;
+};
+const unsigned int EncodedRunIndex::NONE;
+const unsigned int EncodedRunIndex::NUM_BUCKETS;
+
+
+/* Arc lists of all cells of one grid. */
+struct GridCells
+{
+  unsigned int grid_w, grid_h;
+  glyphy_extents_t extents; /* Adjusted to the grid */
+  double avg_fetch;
+  unsigned int max_fetch; /* longest arc list */
+  std::vector<int> sides;
+  std::vector<std::vector<glyphy_arc_endpoint_t> > endpoints; /* may have extra, unused ones */
 
+  void swap (GridCells &other)
+  {
+    std::swap (grid_w, other.grid_w);
+    std::swap (grid_h, other.grid_h);
+    std::swap (extents, other.extents);
+    std::swap (avg_fetch, other.avg_fetch);
+    std::swap (max_fetch, other.max_fetch);
+    sides.swap (other.sides);
+    endpoints.swap (other.endpoints);
+  }
+};
+
+/* Finds the arcs near each cell of a grid_size cells grid along the longer
+ * side of the (padded) extents.
+ *
+ * Cells are independent of each other, so when built with OpenMP and
+ * given more than one thread, they are spread across up to num_threads
+ * threads; zero lets OpenMP pick.  Results only depend on the cell, not on
+ * the thread, so the blob comes out identical either way.  Each thread
+ * works in its own one of thread_indices. */
+static void
+find_grid_cells (const ArcGrid                           &grid,
+		 const glyphy_extents_t                  &padded_extents,
+		 double                                   faraway,
+		 unsigned int                             grid_size,
+		 unsigned int                             num_threads,
+		 GridCells                               &cells,
+		 std::vector<std::vector<unsigned int> > &thread_indices)
+{
+  glyphy_extents_t extents = padded_extents;
   double glyph_width = extents.max_x - extents.min_x;
   double glyph_height = extents.max_y - extents.min_y;
   double unit = std::max (glyph_width, glyph_height);
 
-  unsigned int grid_w = GRID_SIZE;
-  unsigned int grid_h = GRID_SIZE;
+  unsigned int grid_w = grid_size;
+  unsigned int grid_h = grid_size;
 
   if (glyph_width > glyph_height) {
     while ((grid_h - 1) * unit / grid_w > glyph_height)
@@ -210,44 +485,62 @@ glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
   }
 
   double cell_unit = unit / std::max (grid_w, grid_h);
+  Point origin = Point (extents.min_x, extents.min_y);
+  int num_cells = grid_w * grid_h;
 
-  std::vector<glyphy_rgba_t> tex_data;
-  std::vector<glyphy_arc_endpoint_t> near_endpoints;
+  cells.grid_w = grid_w;
+  cells.grid_h = grid_h;
+  cells.extents = extents;
+  cells.sides.resize (num_cells);
+  /* Never shrink, so the cells' lists keep their buffers for next time. */
+  if (cells.endpoints.size () < (unsigned int) num_cells)
+    cells.endpoints.resize (num_cells);
 
-  unsigned int header_length = grid_w * grid_h;
-  unsigned int offset = header_length;
-  tex_data.resize (header_length);
-  Point origin = Point (extents.min_x, extents.min_y);
   unsigned int total_arcs = 0;
+  unsigned int max_arcs = 0;
 
-  for (unsigned int row = 0; row < grid_h; row++)
-    for (unsigned int col = 0; col < grid_w; col++)
+#ifdef _OPENMP
+  if (!num_threads)
+    num_threads = std::max (1, omp_get_max_threads ());
+  if (thread_indices.size () < num_threads)
+    thread_indices.resize (num_threads);
+#else
+  num_threads = 1;
+  thread_indices.resize (1);
+#endif
+
+#ifdef _OPENMP
+#pragma omp parallel if (num_threads > 1 && num_cells >= 64) num_threads (num_threads) reduction (+:total_arcs) reduction (max:max_arcs)
+#endif
+  {
+#ifdef _OPENMP
+    std::vector<unsigned int> &near_indices = thread_indices[omp_get_thread_num ()];
+#else
+    std::vector<unsigned int> &near_indices = thread_indices[0];
+#endif
+
+#ifdef _OPENMP
+#pragma omp for schedule (dynamic, 4)
+#endif
+    for (int cell = 0; cell < num_cells; cell++)
     {
+      unsigned int row = cell / grid_w;
+      unsigned int col = cell % grid_w;
       Point cp0 = origin + Vector ((col + 0) * cell_unit, (row + 0) * cell_unit);
       Point cp1 = origin + Vector ((col + 1) * cell_unit, (row + 1) * cell_unit);
+      std::vector<glyphy_arc_endpoint_t> &near_endpoints = cells.endpoints[cell];
       near_endpoints.clear ();
 
-      int side;
       closest_arcs_to_cell (cp0, cp1,
 			    faraway,
-			    endpoints, num_endpoints,
+			    grid,
+			    near_indices,
 			    near_endpoints,
-			    &side);
-
-#define QUANTIZE_X(X) (lround (MAX_X * ((X - extents.min_x) / glyph_width )))
-#define QUANTIZE_Y(Y) (lround (MAX_Y * ((Y - extents.min_y) / glyph_height)))
-#define DEQUANTIZE_X(X) (double (X) / MAX_X * glyph_width  + extents.min_x)
-#define DEQUANTIZE_Y(Y) (double (Y) / MAX_Y * glyph_height + extents.min_y)
-#define SNAP(P) (Point (DEQUANTIZE_X (QUANTIZE_X ((P).x)), DEQUANTIZE_Y (QUANTIZE_Y ((P).y))))
+			    &cells.sides[cell]);
 
-      if (near_endpoints.size () == 2 && near_endpoints[1].d == 0) {
-        Point c (extents.min_x + glyph_width * .5, extents.min_y + glyph_height * .5);
-        Line line (SNAP (near_endpoints[0].p), SNAP (near_endpoints[1].p));
-	line.c -= line.n * Vector (c);
-	line.c /= unit;
-	tex_data[row * grid_w + col] = line_encode (line);
+      /* A single line is encoded in the cell itself. */
+      if (near_endpoints.size () == 2 && near_endpoints[1].d == 0)
 	continue;
-      }
 
       /* If the arclist is two arcs that can be combined in encoding if reordered,
        * do that. */
@@ -266,63 +559,475 @@ glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
 	near_endpoints.push_back (e2);
       }
 
-      for (unsigned i = 0; i < near_endpoints.size (); i++) {
-        glyphy_arc_endpoint_t &endpoint = near_endpoints[i];
-	tex_data.push_back (arc_endpoint_encode (QUANTIZE_X(endpoint.p.x), QUANTIZE_Y(endpoint.p.y), endpoint.d));
-      }
+      total_arcs += near_endpoints.size ();
+      max_arcs = std::max (max_arcs, (unsigned int) near_endpoints.size ());
+    }
+  }
 
-      unsigned int current_endpoints = tex_data.size () - offset;
+  cells.avg_fetch = 1 + double (total_arcs) / num_cells;
+  cells.max_fetch = max_arcs;
+}
 
-      if (current_endpoints)
-      {
-	/* See if we can fulfill this cell by using already-encoded arcs */
-	const glyphy_rgba_t *needle = &tex_data[offset];
-	unsigned int needle_len = current_endpoints;
-	const glyphy_rgba_t *haystack = &tex_data[header_length];
-	unsigned int haystack_len = offset - header_length;
-
-	bool found = false;
-	while (haystack_len >= needle_len) {
-	  /* Trick: we don't care about first endpoint's d value, so skip one
-	   * byte in comparison.  This works because arc_encode() packs the
-	   * d value in the first byte. */
-	  if (0 == memcmp (1 + (const char *) needle,
-			   1 + (const char *) haystack,
-			   needle_len * sizeof (*needle) - 1)) {
-	    found = true;
-	    break;
-	  }
-	  haystack++;
-	  haystack_len--;
-	}
-	if (found) {
-	  unsigned int new_offset = haystack - &tex_data[0];
-	  tex_data.resize (offset);
-	  haystack = needle = NULL; /* Invalidated by the resize. */
-	  offset = new_offset;
+/* Encodes the cells into tex_data.  If there is a sink, passes it each
+ * arc list as soon as it is there to stay, and the cells at the end.
+ * Returns false if the sink asked to stop; tex_data is finished anyway. */
+static bool
+encode_grid_cells (const GridCells            &cells,
+		   EncodedRunIndex            &run_index,
+		   std::vector<glyphy_rgba_t> &tex_data,
+		   glyphy_blob_sink_func_t     sink,
+		   void                       *user_data)
+{
+  const glyphy_extents_t &extents = cells.extents;
+  unsigned int grid_w = cells.grid_w;
+  unsigned int grid_h = cells.grid_h;
+  double glyph_width = extents.max_x - extents.min_x;
+  double glyph_height = extents.max_y - extents.min_y;
+  double unit = std::max (glyph_width, glyph_height);
+
+  unsigned int header_length = grid_w * grid_h;
+  unsigned int offset = header_length;
+  bool stopped = false;
+  tex_data.clear ();
+  tex_data.resize (header_length);
+  run_index.reset (header_length);
+
+  for (unsigned int cell = 0; cell < grid_w * grid_h; cell++)
+  {
+    const std::vector<glyphy_arc_endpoint_t> &near_endpoints = cells.endpoints[cell];
+
+#define QUANTIZE_X(X) (lround (MAX_X * ((X - extents.min_x) / glyph_width )))
+#define QUANTIZE_Y(Y) (lround (MAX_Y * ((Y - extents.min_y) / glyph_height)))
+#define DEQUANTIZE_X(X) (double (X) / MAX_X * glyph_width  + extents.min_x)
+#define DEQUANTIZE_Y(Y) (double (Y) / MAX_Y * glyph_height + extents.min_y)
+#define SNAP(P) (Point (DEQUANTIZE_X (QUANTIZE_X ((P).x)), DEQUANTIZE_Y (QUANTIZE_Y ((P).y))))
+
+    if (near_endpoints.size () == 2 && near_endpoints[1].d == 0) {
+      Point c (extents.min_x + glyph_width * .5, extents.min_y + glyph_height * .5);
+      Line line (SNAP (near_endpoints[0].p), SNAP (near_endpoints[1].p));
+      line.c -= line.n * Vector (c);
+      line.c /= unit;
+      tex_data[cell] = line_encode (line);
+      continue;
+    }
+
+    for (unsigned i = 0; i < near_endpoints.size (); i++) {
+      const glyphy_arc_endpoint_t &endpoint = near_endpoints[i];
+      tex_data.push_back (arc_endpoint_encode (QUANTIZE_X(endpoint.p.x), QUANTIZE_Y(endpoint.p.y), endpoint.d));
+    }
+
+    unsigned int current_endpoints = tex_data.size () - offset;
+
+    if (current_endpoints)
+    {
+      /* See if we can fulfill this cell by using already-encoded arcs */
+      unsigned int found = run_index.find (tex_data, offset,
+					   &tex_data[offset], current_endpoints);
+      if (found != EncodedRunIndex::NONE) {
+	tex_data.resize (offset);
+	offset = found;
+      } else {
+	run_index.grow (tex_data, tex_data.size ());
+	if (sink && !sink (&tex_data[offset], offset, current_endpoints, user_data)) {
+	  sink = NULL;
+	  stopped = true;
 	}
       }
-      else
-	offset = 0;
+    }
+    else
+      offset = 0;
+
+    tex_data[cell] = arc_list_encode (offset, current_endpoints, cells.sides[cell]);
+    offset = tex_data.size ();
+  }
+
+  if (sink && !sink (&tex_data[0], 0, header_length, user_data))
+    stopped = true;
+  return !stopped;
+}
+
+
+/*
+ * Blob encoder
+ */
+
+struct glyphy_blob_encoder_t
+{
+  unsigned int refcount;
+  unsigned int num_threads;
+
+  /* Kept across glyphs, to not allocate for every one. */
+  ArcGrid grid;
+  GridCells cells, best_cells;
+  std::vector<std::vector<unsigned int> > thread_indices;
+  EncodedRunIndex run_index;
+  std::vector<glyphy_rgba_t> tex_data;
+  std::vector<glyphy_arc_endpoint_t> endpoints64;
+
+  /* What tex_data was encoded from, if it is complete, and the rest of
+   * the results; encoding the same again only outputs them. */
+  bool have_last;
+  std::vector<glyphy_arc_endpoint_t> last_endpoints;
+  double last_faraway;
+  double last_avg_fetch_desired;
+  double avg_fetch;
+  unsigned int grid_w, grid_h;
+  glyphy_extents_t extents;
+};
+
+glyphy_blob_encoder_t *
+glyphy_blob_encoder_create (void)
+{
+  glyphy_blob_encoder_t *encoder = new glyphy_blob_encoder_t;
+  encoder->refcount = 1;
+  encoder->num_threads = 1;
+  encoder->have_last = false;
+
+  return encoder;
+}
+
+void
+glyphy_blob_encoder_destroy (glyphy_blob_encoder_t *encoder)
+{
+  if (!encoder || --encoder->refcount)
+    return;
+
+  delete encoder;
+}
+
+glyphy_blob_encoder_t *
+glyphy_blob_encoder_reference (glyphy_blob_encoder_t *encoder)
+{
+  if (encoder)
+    encoder->refcount++;
+  return encoder;
+}
+
+void
+glyphy_blob_encoder_set_num_threads (glyphy_blob_encoder_t *encoder,
+				     unsigned int           num_threads)
+{
+  encoder->num_threads = num_threads;
+}
+
+unsigned int
+glyphy_blob_encoder_get_num_threads (glyphy_blob_encoder_t *encoder)
+{
+  return encoder->num_threads;
+}
+
+/* Encodes into encoder->tex_data, and the other results fields.
+ * Returns false if the sink asked to stop; the results are complete
+ * either way, so encoding the same again only outputs them. */
+static bool
+encode (glyphy_blob_encoder_t       *encoder,
+	const glyphy_arc_endpoint_t *endpoints,
+	unsigned int                 num_endpoints,
+	double                       faraway,
+	double                       avg_fetch_desired,
+	glyphy_blob_sink_func_t      sink,
+	void                        *user_data)
+{
+  std::vector<glyphy_rgba_t> &tex_data = encoder->tex_data;
+  bool ret = true;
+
+  if (encoder->have_last &&
+      encoder->last_endpoints.size () == num_endpoints &&
+      (!num_endpoints ||
+       0 == memcmp (&encoder->last_endpoints[0], endpoints, num_endpoints * sizeof (endpoints[0]))) &&
+      encoder->last_faraway == faraway &&
+      encoder->last_avg_fetch_desired == avg_fetch_desired)
+    return !sink || sink (&tex_data[0], 0, tex_data.size (), user_data);
+  encoder->have_last = false;
+
+  glyphy_extents_t extents;
+  glyphy_extents_clear (&extents);
+
+  glyphy_arc_list_extents (endpoints, num_endpoints, &extents);
+
+  if (glyphy_extents_is_empty (&extents)) {
+    tex_data.assign (1, arc_list_encode (0, 0, +1));
+    encoder->avg_fetch = 1;
+    encoder->grid_w = encoder->grid_h = 1;
+    encoder->extents = extents;
+  }
+  else
+  {
+    /* Add antialiasing padding */
+    extents.min_x -= faraway;
+    extents.min_y -= faraway;
+    extents.max_x += faraway;
+    extents.max_y += faraway;
+
+    ArcGrid &grid = encoder->grid;
+    grid.build (endpoints, num_endpoints, extents);
+
+    /* Find the coarsest grid that meets the desired average fetch count,
+     * with no cell holding more endpoints than the shader reads.  Blob
+     * size grows with the grid, so that is the smallest blob too.
+     *
+     * The number of endpoints fetched per cell falls roughly in inverse
+     * proportion to the grid size.  Use that to guess the next grid size
+     * to try, while keeping the answer bracketed in [lo, hi].  Only the
+     * winning candidate is encoded.  If even the finest grid misses the
+     * target, use that.
+     */
+    GridCells &cells = encoder->cells, &best_cells = encoder->best_cells;
+    unsigned int lo = 1, hi = MAX_GRID_SIZE + 1;
+    unsigned int grid_size = 8;
+    while (lo < hi)
+    {
+      grid_size = std::max (lo, std::min (hi - 1, grid_size));
+
+      find_grid_cells (grid, extents, faraway, grid_size, encoder->num_threads,
+		       cells, encoder->thread_indices);
+      double avg_fetch = cells.avg_fetch;
+      unsigned int max_fetch = cells.max_fetch;
 
-      tex_data[row * grid_w + col] = arc_list_encode (offset, current_endpoints, side);
-      offset = tex_data.size ();
+      if (avg_fetch <= avg_fetch_desired && max_fetch <= GLYPHY_MAX_NUM_ENDPOINTS) {
+	hi = grid_size;
+	best_cells.swap (cells);
+      } else
+	lo = grid_size + 1;
 
-      total_arcs += current_endpoints;
+      unsigned int next_size;
+      if (avg_fetch <= 1)
+	next_size = 1;
+      else if (avg_fetch_desired <= 1)
+	next_size = MAX_GRID_SIZE;
+      else
+	next_size = lround (grid_size * ((avg_fetch - 1) / (avg_fetch_desired - 1)));
+      if (max_fetch > GLYPHY_MAX_NUM_ENDPOINTS)
+	next_size = std::max (next_size, (unsigned int) ceil (grid_size * double (max_fetch) / GLYPHY_MAX_NUM_ENDPOINTS));
+      grid_size = next_size;
     }
+    if (hi > MAX_GRID_SIZE)
+      best_cells.swap (cells); /* Last candidate was the finest grid. */
+
+    encoder->avg_fetch = best_cells.avg_fetch;
+    encoder->grid_w = best_cells.grid_w;
+    encoder->grid_h = best_cells.grid_h;
+    encoder->extents = best_cells.extents;
+
+    ret = encode_grid_cells (best_cells, encoder->run_index, tex_data, sink, user_data);
+    sink = NULL;
+  }
+
+  if (sink && !sink (&tex_data[0], 0, tex_data.size (), user_data))
+    ret = false;
+
+  encoder->last_endpoints.assign (endpoints, endpoints + num_endpoints);
+  encoder->last_faraway = faraway;
+  encoder->last_avg_fetch_desired = avg_fetch_desired;
+  encoder->have_last = true;
+  return ret;
+}
 
+static void
+get_results (glyphy_blob_encoder_t *encoder,
+	     double                *avg_fetch_achieved,
+	     unsigned int          *output_len,
+	     unsigned int          *nominal_width,
+	     unsigned int          *nominal_height,
+	     glyphy_extents_t      *extents)
+{
   if (avg_fetch_achieved)
-    *avg_fetch_achieved = 1 + double (total_arcs) / (grid_w * grid_h);
+    *avg_fetch_achieved = encoder->avg_fetch;
+  *output_len = encoder->tex_data.size ();
+  *nominal_width = encoder->grid_w;
+  *nominal_height = encoder->grid_h;
+  *extents = encoder->extents;
+}
 
-  *pextents = extents;
+glyphy_bool_t
+glyphy_blob_encoder_encode (glyphy_blob_encoder_t       *encoder,
+			    const glyphy_arc_endpoint_t *endpoints,
+			    unsigned int                 num_endpoints,
+			    glyphy_rgba_t               *blob,
+			    unsigned int                 blob_size,
+			    double                       faraway,
+			    double                       avg_fetch_desired,
+			    double                      *avg_fetch_achieved,
+			    unsigned int                *output_len,
+			    unsigned int                *nominal_width,  /* 6bit */
+			    unsigned int                *nominal_height, /* 6bit */
+			    glyphy_extents_t            *extents)
+{
+  encode (encoder, endpoints, num_endpoints, faraway, avg_fetch_desired, NULL, NULL);
+  get_results (encoder, avg_fetch_achieved, output_len, nominal_width, nominal_height, extents);
 
+  const std::vector<glyphy_rgba_t> &tex_data = encoder->tex_data;
   if (tex_data.size () > blob_size)
     return false;
 
-  memcpy (blob, &tex_data[0], tex_data.size () * sizeof(tex_data[0]));
-  *output_len = tex_data.size ();
-  *nominal_width = grid_w;
-  *nominal_height = grid_h;
+  memcpy (blob, &tex_data[0], tex_data.size () * sizeof (tex_data[0]));
+  return true;
+}
+
+glyphy_bool_t
+glyphy_blob_encoder_encode_to_sink (glyphy_blob_encoder_t       *encoder,
+				    const glyphy_arc_endpoint_t *endpoints,
+				    unsigned int                 num_endpoints,
+				    glyphy_blob_sink_func_t      sink,
+				    void                        *user_data,
+				    double                       faraway,
+				    double                       avg_fetch_desired,
+				    double                      *avg_fetch_achieved,
+				    unsigned int                *output_len,
+				    unsigned int                *nominal_width,  /* 6bit */
+				    unsigned int                *nominal_height, /* 6bit */
+				    glyphy_extents_t            *extents)
+{
+  glyphy_bool_t ret = encode (encoder, endpoints, num_endpoints, faraway, avg_fetch_desired, sink, user_data);
+  get_results (encoder, avg_fetch_achieved, output_len, nominal_width, nominal_height, extents);
+  return ret;
+}
+
+/* Sink writing a blob in rows, for glyphy_blob_encoder_encode_to_rows() */
+struct RowWriter
+{
+  glyphy_rgba_t *region;
+  unsigned int stride;
+  unsigned int row_width;
+  unsigned int max_rows;
+  bool overflow;
+
+  static glyphy_bool_t write (const glyphy_rgba_t *texels,
+			      unsigned int         offset,
+			      unsigned int         num_texels,
+			      void                *user_data)
+  {
+    RowWriter &writer = *(RowWriter *) user_data;
+    if (offset + num_texels > writer.row_width * writer.max_rows) {
+      writer.overflow = true;
+      return false;
+    }
+    while (num_texels)
+    {
+      unsigned int col = offset % writer.row_width;
+      unsigned int n = std::min (num_texels, writer.row_width - col);
+      memcpy (writer.region + offset / writer.row_width * writer.stride + col,
+	      texels, n * sizeof (*texels));
+      texels += n;
+      offset += n;
+      num_texels -= n;
+    }
+    return true;
+  }
+};
+
+glyphy_bool_t
+glyphy_blob_encoder_encode_to_rows (glyphy_blob_encoder_t       *encoder,
+				    const glyphy_arc_endpoint_t *endpoints,
+				    unsigned int                 num_endpoints,
+				    glyphy_rgba_t               *region,
+				    unsigned int                 stride,
+				    unsigned int                 row_width,
+				    unsigned int                 max_rows,
+				    unsigned int                 row_quantum,
+				    unsigned int                *rows_used,
+				    double                       faraway,
+				    double                       avg_fetch_desired,
+				    double                      *avg_fetch_achieved,
+				    unsigned int                *output_len,
+				    unsigned int                *nominal_width,  /* 6bit */
+				    unsigned int                *nominal_height, /* 6bit */
+				    glyphy_extents_t            *extents)
+{
+  assert (row_width && stride >= row_width);
+  row_quantum = std::max (1u, row_quantum);
+
+  RowWriter writer = {region, stride, row_width, max_rows, false};
+  encode (encoder, endpoints, num_endpoints, faraway, avg_fetch_desired,
+	  RowWriter::write, &writer);
+  get_results (encoder, avg_fetch_achieved, output_len, nominal_width, nominal_height, extents);
+
+  unsigned int len = *output_len;
+  unsigned int rows = (len + row_width - 1) / row_width;
+  rows = (rows + row_quantum - 1) / row_quantum * row_quantum;
+  *rows_used = rows;
+  if (writer.overflow || rows > max_rows)
+    return false;
+
+  /* Clear the rest of the last row, and the rows up to the quantum. */
+  for (unsigned int offset = len; offset < rows * row_width; )
+  {
+    unsigned int col = offset % row_width;
+    memset (region + offset / row_width * stride + col, 0,
+	    (row_width - col) * sizeof (*region));
+    offset += row_width - col;
+  }
 
   return true;
 }
+
+glyphy_bool_t
+glyphy_blob_encoder_encode32 (glyphy_blob_encoder_t         *encoder,
+			      const glyphy_arc_endpoint32_t *endpoints,
+			      unsigned int                   num_endpoints,
+			      glyphy_rgba_t                 *blob,
+			      unsigned int                   blob_size,
+			      double                         faraway,
+			      double                         avg_fetch_desired,
+			      double                        *avg_fetch_achieved,
+			      unsigned int                  *output_len,
+			      unsigned int                  *nominal_width,  /* 6bit */
+			      unsigned int                  *nominal_height, /* 6bit */
+			      glyphy_extents_t              *extents)
+{
+  std::vector<glyphy_arc_endpoint_t> &endpoints64 = encoder->endpoints64;
+  endpoints_from_32 (endpoints, num_endpoints, endpoints64);
+  return glyphy_blob_encoder_encode (encoder,
+				     endpoints64.size () ? &endpoints64[0] : NULL,
+				     num_endpoints, blob, blob_size,
+				     faraway, avg_fetch_desired, avg_fetch_achieved,
+				     output_len, nominal_width, nominal_height,
+				     extents);
+}
+
+
+glyphy_bool_t
+glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
+			     unsigned int                 num_endpoints,
+			     glyphy_rgba_t               *blob,
+			     unsigned int                 blob_size,
+			     double                       faraway,
+			     double                       avg_fetch_desired,
+			     double                      *avg_fetch_achieved,
+			     unsigned int                *output_len,
+			     unsigned int                *nominal_width,  /* 6bit */
+			     unsigned int                *nominal_height, /* 6bit */
+			     glyphy_extents_t            *extents)
+{
+  glyphy_blob_encoder_t *encoder = glyphy_blob_encoder_create ();
+  glyphy_bool_t ret = glyphy_blob_encoder_encode (encoder, endpoints, num_endpoints,
+						  blob, blob_size,
+						  faraway, avg_fetch_desired, avg_fetch_achieved,
+						  output_len, nominal_width, nominal_height,
+						  extents);
+  glyphy_blob_encoder_destroy (encoder);
+  return ret;
+}
+
+glyphy_bool_t
+glyphy_arc_list_encode_blob32 (const glyphy_arc_endpoint32_t *endpoints,
+			       unsigned int                   num_endpoints,
+			       glyphy_rgba_t                 *blob,
+			       unsigned int                   blob_size,
+			       double                         faraway,
+			       double                         avg_fetch_desired,
+			       double                        *avg_fetch_achieved,
+			       unsigned int                  *output_len,
+			       unsigned int                  *nominal_width,  /* 6bit */
+			       unsigned int                  *nominal_height, /* 6bit */
+			       glyphy_extents_t              *extents)
+{
+  glyphy_blob_encoder_t *encoder = glyphy_blob_encoder_create ();
+  glyphy_bool_t ret = glyphy_blob_encoder_encode32 (encoder, endpoints, num_endpoints,
+						    blob, blob_size,
+						    faraway, avg_fetch_desired, avg_fetch_achieved,
+						    output_len, nominal_width, nominal_height,
+						    extents);
+  glyphy_blob_encoder_destroy (encoder);
+  return ret;
+}
@@ -44,8 +44,28 @@ iszero (double v)
 }
 
 
+/* Widens single-precision endpoints for code that works in double. */
+static inline void
+endpoints_from_32 (const glyphy_arc_endpoint32_t    *endpoints,
+		   unsigned int                      num_endpoints,
+		   std::vector<glyphy_arc_endpoint_t> &out)
+{
+  out.resize (num_endpoints);
+  for (unsigned int i = 0; i < num_endpoints; i++) {
+    out[i].p.x = endpoints[i].p.x;
+    out[i].p.y = endpoints[i].p.y;
+    out[i].d = endpoints[i].d;
+  }
+}
+
+
 #define GLYPHY_MAX_D .5
 
+/* Most endpoints glyphy-sdf.glsl reads from a cell's arc list. */
+#ifndef GLYPHY_MAX_NUM_ENDPOINTS
+#define GLYPHY_MAX_NUM_ENDPOINTS 32
+#endif
+
 #undef  ARRAY_LENGTH
 #define ARRAY_LENGTH(__array) ((signed int) (sizeof (__array) / sizeof (__array[0])))
 
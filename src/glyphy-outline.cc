@@ -22,8 +22,12 @@
 
 #include "glyphy-common.hh"
 #include "glyphy-geometry.hh"
+#include "glyphy-arc-list.hh"
+#include "glyphy-arc-bezier.hh"
 
 using namespace GLyphy::Geometry;
+using namespace GLyphy::ArcList;
+using namespace GLyphy::ArcBezier;
 
 
 void
@@ -88,11 +92,278 @@ is_zero (double v)
   return fabs (v) < GLYPHY_EPSILON;
 }
 
+/* Halfline crossings of one arc, for even_odd().  ArcType is Arc, or
+ * anything else with the same members and methods. */
+template <typename ArcType>
+static double
+arc_crossings (const ArcType &arc, const Point &p)
+{
+  double count = 0;
+
+  /* End-point y's compared to the ref point; lt, eq, or gt */
+  unsigned s0 = categorize (arc.p0.y, p.y);
+  unsigned s1 = categorize (arc.p1.y, p.y);
+
+  if (is_zero (arc.d))
+  {
+    /* Line */
+
+    if (!s0 || !s1)
+    {
+      /*
+       * Add +.5 / -.5 for each endpoint on the halfline, depending on
+       * crossing direction.
+       */
+      Pair<Vector> t = arc.tangents ();
+      if (!s0 && arc.p0.x < p.x + GLYPHY_EPSILON)
+	count += .5 * categorize (t.first.dy, 0);
+      if (!s1 && arc.p1.x < p.x + GLYPHY_EPSILON)
+	count += .5 * categorize (t.second.dy, 0);
+      return count;
+    }
+
+    if (s0 == s1)
+      return count; // Segment fully above or below the halfline
+
+    // Find x pos that the line segment would intersect the half-line.
+    double x = arc.p0.x + (arc.p1.x - arc.p0.x) * ((p.y - arc.p0.y) / (arc.p1.y - arc.p0.y));
+
+    if (x >= p.x - GLYPHY_EPSILON)
+      return count; // Does not intersect halfline
+
+    count++; // Add one for full crossing
+    return count;
+  }
+  else
+  {
+    /* Arc */
+
+    if (!s0 || !s1)
+    {
+      /*
+       * Add +.5 / -.5 for each endpoint on the halfline, depending on
+       * crossing direction.
+       */
+      Pair<Vector> t = arc.tangents ();
+
+      /* Arc-specific logic:
+       * If the tangent has dy==0, use the other endpoint's
+       * y value to decide which way the arc will be heading.
+       */
+      if (is_zero (t.first.dy))
+	t.first.dy  = +categorize (arc.p1.y, p.y);
+      if (is_zero (t.second.dy))
+	t.second.dy = -categorize (arc.p0.y, p.y);
+
+      if (!s0 && arc.p0.x < p.x + GLYPHY_EPSILON)
+	count += .5 * categorize (t.first.dy, 0);
+      if (!s1 && arc.p1.x < p.x + GLYPHY_EPSILON)
+	count += .5 * categorize (t.second.dy, 0);
+    }
+
+    Point c = arc.center ();
+    double r = arc.radius ();
+    if (c.x - r >= p.x)
+      return count; // No chance
+    /* Solve for arc crossing line with y = p.y */
+    double dy = p.y - c.y;
+    double x2 = r * r - dy * dy;
+    if (x2 <= GLYPHY_EPSILON)
+      return count; // Negative delta, no crossing
+    double dx = sqrt (x2);
+    /* There's two candidate points on the arc with the same y as the
+     * ref point. */
+    Point pp[2] = { Point (c.x - dx, p.y),
+		    Point (c.x + dx, p.y) };
+
+#define POINTS_EQ(a,b) (is_zero (a.x - b.x) && is_zero (a.y - b.y))
+    for (unsigned int i = 0; i < ARRAY_LENGTH (pp); i++)
+    {
+      /* Make sure we don't double-count endpoints that fall on the
+       * halfline as we already accounted for those above */
+      if (!POINTS_EQ (pp[i], arc.p0) && !POINTS_EQ (pp[i], arc.p1) &&
+	  pp[i].x < p.x - GLYPHY_EPSILON && arc.wedge_contains_point (pp[i]))
+	count++; // Add one for full crossing
+    }
+#undef POINTS_EQ
+    return count;
+  }
+}
+
+/* Arc interface for arc_crossings() on a prepared arc */
+struct CachedArc
+{
+  const PreparedArc &prepared;
+  const Point &p0, &p1;
+  double d;
+
+  CachedArc (const PreparedArc &prepared_) :
+    prepared (prepared_), p0 (prepared_.arc.p0), p1 (prepared_.arc.p1), d (prepared_.arc.d) {}
+
+  inline const Pair<Vector> &tangents (void) const { return prepared.tangents; }
+  inline const Point &center (void) const { return prepared.center; }
+  inline double radius (void) const { return prepared.radius; }
+  inline bool wedge_contains_point (const Point &p) const { return prepared.wedge_contains_point (p); }
+};
+
+/* A box around the arc ending at endpoint.  Cheaper than Arc::extents();
+ * for |d| <= 1 the arc is within its sagitta, |d| times half the chord,
+ * of the chord. */
+static inline void
+arc_bounds (const glyphy_point_t &p0, const glyphy_arc_endpoint_t &endpoint,
+	    glyphy_extents_t &extents)
+{
+  const glyphy_point_t &p1 = endpoint.p;
+  if (fabs (endpoint.d) > 1) {
+    Arc (p0, p1, endpoint.d).extents (extents);
+    return;
+  }
+  double h = fabs (endpoint.d) * .5 * (fabs (p1.x - p0.x) + fabs (p1.y - p0.y));
+  extents.min_x = std::min (p0.x, p1.x) - h;
+  extents.max_x = std::max (p0.x, p1.x) + h;
+  extents.min_y = std::min (p0.y, p1.y) - h;
+  extents.max_y = std::max (p0.y, p1.y) + h;
+}
+
+static inline bool
+reaches_halfline (const glyphy_extents_t &extents, const Point &p, double margin)
+{
+  return extents.min_x <= p.x + margin &&
+	 extents.min_y <= p.y + margin && p.y - margin <= extents.max_y;
+}
+
+/* Where the arcs of an outline are, for even_odd() to only visit the
+ * ones that can reach the halfline.  Contours keep their bounds.  With
+ * many contours, arcs are also bucketed by the y range they span; they
+ * are known by the endpoint they ended at when indexed, so reversing a
+ * contour in place only needs marking it reversed. */
+struct OutlineIndex
+{
+  struct Contour
+  {
+    unsigned int start, end;
+    glyphy_extents_t extents;
+    bool reversed;
+  };
+
+  std::vector<Contour> contours;
+
+  /* Buckets; empty with few contours. */
+  std::vector<unsigned int> arc_contour; /* by endpoint */
+  std::vector<glyphy_extents_t> arc_extents; /* by endpoint */
+  double min_y, bucket_height;
+  std::vector<unsigned int> bucket_start; /* into entries, one past the last bucket too */
+  std::vector<unsigned int> entries; /* endpoints of the arcs in each bucket */
+
+  OutlineIndex (const glyphy_arc_endpoint_t *endpoints,
+		unsigned int                 num_endpoints,
+		const glyphy_contour_t      *given_contours,
+		unsigned int                 num_given_contours);
+
+  unsigned int bucket (double y) const
+  {
+    double k = floor ((y - min_y) / bucket_height);
+    unsigned int num_buckets = bucket_start.size () - 1;
+    return k <= 0 ? 0 : k >= num_buckets ? num_buckets - 1 : (unsigned int) k;
+  }
+
+  /* Endpoint that the arc indexed as ending at i ends at now. */
+  unsigned int arc_endpoint (unsigned int i) const
+  {
+    const Contour &contour = contours[arc_contour[i]];
+    return contour.reversed ? contour.start + contour.end - i : i;
+  }
+
+  private:
+  void build_buckets (const glyphy_arc_endpoint_t *endpoints,
+		      unsigned int                 num_endpoints);
+};
+
+/* Below this many contours, scanning the ones that reach the halfline
+ * beats building buckets. */
+#define MIN_CONTOURS_TO_BUCKET 8
+
+OutlineIndex::OutlineIndex (const glyphy_arc_endpoint_t *endpoints,
+			    unsigned int                 num_endpoints,
+			    const glyphy_contour_t      *given_contours,
+			    unsigned int                 num_given_contours) :
+  min_y (0), bucket_height (1)
+{
+  if (given_contours) {
+    for (unsigned int i = 0; i < num_given_contours; i++) {
+      Contour contour = {given_contours[i].start,
+			 given_contours[i].start + given_contours[i].num_endpoints,
+			 given_contours[i].extents, false};
+      contours.push_back (contour);
+    }
+  } else {
+    Contour contour = {0, 0, {0, 0, 0, 0}, false};
+    for (unsigned int i = 1; i <= num_endpoints; i++)
+      if (i == num_endpoints || endpoints[i].d == GLYPHY_INFINITY) {
+	contour.end = i;
+	glyphy_extents_clear (&contour.extents);
+	for (unsigned int j = contour.start + 1; j < contour.end; j++) {
+	  glyphy_extents_t extents;
+	  arc_bounds (endpoints[j - 1].p, endpoints[j], extents);
+	  glyphy_extents_extend (&contour.extents, &extents);
+	}
+	contours.push_back (contour);
+	contour.start = i;
+      }
+  }
+
+  if (contours.size () >= MIN_CONTOURS_TO_BUCKET)
+    build_buckets (endpoints, num_endpoints);
+}
+
+void
+OutlineIndex::build_buckets (const glyphy_arc_endpoint_t *endpoints,
+			     unsigned int                 num_endpoints)
+{
+  const double margin = 2 * GLYPHY_EPSILON;
+
+  arc_contour.resize (num_endpoints);
+  arc_extents.resize (num_endpoints);
+  glyphy_extents_t all;
+  glyphy_extents_clear (&all);
+  unsigned int num_arcs = 0;
+  for (unsigned int c = 0; c < contours.size (); c++) {
+    for (unsigned int i = contours[c].start + 1; i < contours[c].end; i++) {
+      arc_bounds (endpoints[i - 1].p, endpoints[i], arc_extents[i]);
+      arc_contour[i] = c;
+      num_arcs++;
+    }
+    glyphy_extents_extend (&all, &contours[c].extents);
+  }
+
+  unsigned int num_buckets = std::max (1u, num_arcs / 2);
+  if (!glyphy_extents_is_empty (&all) && all.max_y > all.min_y) {
+    min_y = all.min_y;
+    bucket_height = (all.max_y - all.min_y) / num_buckets;
+  } else
+    num_buckets = 1;
+
+  /* Count, then fill. */
+  bucket_start.assign (num_buckets + 1, 0);
+  for (unsigned int c = 0; c < contours.size (); c++)
+    for (unsigned int i = contours[c].start + 1; i < contours[c].end; i++)
+      for (unsigned int k = bucket (arc_extents[i].min_y - margin); k <= bucket (arc_extents[i].max_y + margin); k++)
+	bucket_start[k + 1]++;
+  for (unsigned int k = 0; k < num_buckets; k++)
+    bucket_start[k + 1] += bucket_start[k];
+  entries.resize (bucket_start[num_buckets]);
+  std::vector<unsigned int> fill (bucket_start.begin (), bucket_start.end () - 1);
+  for (unsigned int c = 0; c < contours.size (); c++)
+    for (unsigned int i = contours[c].start + 1; i < contours[c].end; i++)
+      for (unsigned int k = bucket (arc_extents[i].min_y - margin); k <= bucket (arc_extents[i].max_y + margin); k++)
+	entries[fill[k]++] = i;
+}
+
 static bool
-even_odd (const glyphy_arc_endpoint_t *c_endpoints,
-	  unsigned int                 num_c_endpoints,
-	  const glyphy_arc_endpoint_t *endpoints,
-	  unsigned int                 num_endpoints)
+even_odd (const glyphy_arc_endpoint_t *endpoints,
+	  const OutlineIndex          &index,
+	  unsigned int                 c,
+	  std::vector<unsigned int>   *visited = NULL /* contours looked at */)
 {
   /*
    * Algorithm:
@@ -153,131 +424,89 @@ even_odd (const glyphy_arc_endpoint_t *c_endpoints,
    *   implement right now.
    */
 
-  const Point p = c_endpoints[0].p;
+  const Point p = endpoints[index.contours[c].start].p;
+  const double margin = 2 * GLYPHY_EPSILON;
 
+  /* Arcs are visited in whatever order; counts are sums of halves, so
+   * that doesn't change them. */
   double count = 0;
-  Point p0 (0, 0);
-  for (unsigned int i = 0; i < num_endpoints; i++) {
-    const glyphy_arc_endpoint_t &endpoint = endpoints[i];
-    if (endpoint.d == GLYPHY_INFINITY) {
-      p0 = endpoint.p;
-      continue;
+  if (index.bucket_start.empty ())
+  {
+    for (unsigned int arc_c = 0; arc_c < index.contours.size (); arc_c++)
+    {
+      /*
+       * Skip our own contour, and what can't reach the halfline
+       */
+      const OutlineIndex::Contour &contour = index.contours[arc_c];
+      if (arc_c == c || !reaches_halfline (contour.extents, p, margin))
+	continue;
+      if (visited)
+	visited->push_back (arc_c);
+
+      for (unsigned int i = contour.start + 1; i < contour.end; i++) {
+	glyphy_extents_t extents;
+	arc_bounds (endpoints[i - 1].p, endpoints[i], extents);
+	if (reaches_halfline (extents, p, margin))
+	  count += arc_crossings (Arc (endpoints[i - 1].p, endpoints[i].p, endpoints[i].d), p);
+      }
     }
-    Arc arc (p0, endpoint.p, endpoint.d);
-    p0 = endpoint.p;
+  }
+  else
+  {
+    /* Only arcs in p's bucket can reach the halfline. */
+    unsigned int k = index.bucket (p.y);
+    for (unsigned int j = index.bucket_start[k]; j < index.bucket_start[k + 1]; j++) {
+      unsigned int i = index.entries[j];
+      unsigned int arc_c = index.arc_contour[i];
+      if (arc_c == c ||
+	  !reaches_halfline (index.contours[arc_c].extents, p, margin) ||
+	  !reaches_halfline (index.arc_extents[i], p, margin))
+	continue;
+      if (visited && (visited->empty () || visited->back () != arc_c))
+	visited->push_back (arc_c);
 
-    /*
-     * Skip our own contour
-     */
-    if (&endpoint >= c_endpoints && &endpoint < c_endpoints + num_c_endpoints)
-      continue;
+      i = index.arc_endpoint (i);
+      count += arc_crossings (Arc (endpoints[i - 1].p, endpoints[i].p, endpoints[i].d), p);
+    }
+  }
 
-    /* End-point y's compared to the ref point; lt, eq, or gt */
-    unsigned s0 = categorize (arc.p0.y, p.y);
-    unsigned s1 = categorize (arc.p1.y, p.y);
+  return !(int (floor (count)) & 1);
+}
 
-    if (is_zero (arc.d))
-    {
-      /* Line */
-
-      if (!s0 || !s1)
-      {
-        /*
-	 * Add +.5 / -.5 for each endpoint on the halfline, depending on
-	 * crossing direction.
-	 */
-        Pair<Vector> t = arc.tangents ();
-        if (!s0 && arc.p0.x < p.x + GLYPHY_EPSILON)
-	  count += .5 * categorize (t.first.dy, 0);
-        if (!s1 && arc.p1.x < p.x + GLYPHY_EPSILON)
-	  count += .5 * categorize (t.second.dy, 0);
-	continue;
-      }
+static bool
+even_odd_prepared (const glyphy_arc_list_t   *arc_list,
+		   unsigned int               start,
+		   unsigned int               end,
+		   std::vector<unsigned int> &indices)
+{
+  /* Same as even_odd(), but only visits arcs that can reach the halfline. */
 
-      if (s0 == s1)
-        continue; // Segment fully above or below the halfline
+  const Point p = arc_list->endpoints[start].p;
 
-      // Find x pos that the line segment would intersect the half-line.
-      double x = arc.p0.x + (arc.p1.x - arc.p0.x) * ((p.y - arc.p0.y) / (arc.p1.y - arc.p0.y));
+  double margin = 2 * GLYPHY_EPSILON;
+  glyphy_extents_t box = {-GLYPHY_INFINITY, p.y - margin, p.x + margin, p.y + margin};
+  arc_list->tree.query (arc_list->arcs, box, indices);
 
-      if (x >= p.x - GLYPHY_EPSILON)
-	continue; // Does not intersect halfline
+  double count = 0;
+  for (unsigned int k = 0; k < indices.size (); k++) {
+    const PreparedArc &arc = arc_list->arcs[indices[k]];
 
-      count++; // Add one for full crossing
+    /*
+     * Skip our own contour
+     */
+    if (arc.endpoint >= start && arc.endpoint < end)
       continue;
-    }
-    else
-    {
-      /* Arc */
-
-      if (!s0 || !s1)
-      {
-        /*
-	 * Add +.5 / -.5 for each endpoint on the halfline, depending on
-	 * crossing direction.
-	 */
-        Pair<Vector> t = arc.tangents ();
-
-	/* Arc-specific logic:
-	 * If the tangent has dy==0, use the other endpoint's
-	 * y value to decide which way the arc will be heading.
-	 */
-	if (is_zero (t.first.dy))
-	  t.first.dy  = +categorize (arc.p1.y, p.y);
-	if (is_zero (t.second.dy))
-	  t.second.dy = -categorize (arc.p0.y, p.y);
-
-        if (!s0 && arc.p0.x < p.x + GLYPHY_EPSILON)
-	  count += .5 * categorize (t.first.dy, 0);
-        if (!s1 && arc.p1.x < p.x + GLYPHY_EPSILON)
-	  count += .5 * categorize (t.second.dy, 0);
-      }
-
-      Point c = arc.center ();
-      double r = arc.radius ();
-      if (c.x - r >= p.x)
-        continue; // No chance
-      /* Solve for arc crossing line with y = p.y */
-      double dy = p.y - c.y;
-      double x2 = r * r - dy * dy;
-      if (x2 <= GLYPHY_EPSILON)
-        continue; // Negative delta, no crossing
-      double dx = sqrt (x2);
-      /* There's two candidate points on the arc with the same y as the
-       * ref point. */
-      Point pp[2] = { Point (c.x - dx, p.y),
-		      Point (c.x + dx, p.y) };
 
-#define POINTS_EQ(a,b) (is_zero (a.x - b.x) && is_zero (a.y - b.y))
-      for (unsigned int i = 0; i < ARRAY_LENGTH (pp); i++)
-      {
-        /* Make sure we don't double-count endpoints that fall on the
-	 * halfline as we already accounted for those above */
-        if (!POINTS_EQ (pp[i], arc.p0) && !POINTS_EQ (pp[i], arc.p1) &&
-	    pp[i].x < p.x - GLYPHY_EPSILON && arc.wedge_contains_point (pp[i]))
-	  count++; // Add one for full crossing
-      }
-#undef POINTS_EQ
-    }
+    count += arc_crossings (CachedArc (arc), p);
   }
 
   return !(int (floor (count)) & 1);
 }
 
 static bool
-process_contour (glyphy_arc_endpoint_t       *endpoints,
-		 unsigned int                 num_endpoints,
-		 const glyphy_arc_endpoint_t *all_endpoints,
-		 unsigned int                 num_all_endpoints,
-		 bool                         inverse)
+contour_is_closed (const glyphy_arc_endpoint_t *endpoints,
+		   unsigned int                 num_endpoints)
 {
-  /*
-   * Algorithm:
-   *
-   * - Find the winding direction and even-odd number,
-   * - If the two disagree, reverse the contour, inplace.
-   */
-
   if (!num_endpoints)
     return false;
 
@@ -290,11 +519,85 @@ process_contour (glyphy_arc_endpoint_t       *endpoints,
     return false; // Need a closed contour
    }
 
+  return true;
+}
+
+static bool
+contour_needs_reversing (const glyphy_arc_endpoint_t *all_endpoints,
+			 const OutlineIndex          &index,
+			 unsigned int                 c,
+			 bool                         inverse,
+			 const glyphy_contour_t      *given_contour = NULL,
+			 std::vector<unsigned int>   *visited = NULL)
+{
+  /*
+   * Algorithm:
+   *
+   * - Find the winding direction and even-odd number,
+   * - The contour needs reversing if the two disagree.
+   */
+
+  const OutlineIndex::Contour &contour = index.contours[c];
+  const glyphy_arc_endpoint_t *endpoints = all_endpoints + contour.start;
+  unsigned int num_endpoints = contour.end - contour.start;
+
+  if (!contour_is_closed (endpoints, num_endpoints))
+    return false;
+
+  return inverse ^
+	 (given_contour ? given_contour->area < 0 : winding (endpoints, num_endpoints)) ^
+	 even_odd (all_endpoints, index, c, visited);
+}
+
+static void
+reverse_contour (glyphy_arc_endpoint_t *all_endpoints,
+		 OutlineIndex          &index,
+		 unsigned int           c)
+{
+  OutlineIndex::Contour &contour = index.contours[c];
+  glyphy_outline_reverse (all_endpoints + contour.start, contour.end - contour.start);
+  contour.reversed = !contour.reversed;
+}
+
+static bool
+process_contour (glyphy_arc_endpoint_t *all_endpoints,
+		 OutlineIndex          &index,
+		 unsigned int           c,
+		 bool                   inverse,
+		 const glyphy_contour_t *given_contour = NULL)
+{
+  /* Reverses the contour, in place, if it needs it. */
+
+  if (contour_needs_reversing (all_endpoints, index, c, inverse, given_contour))
+  {
+    reverse_contour (all_endpoints, index, c);
+    return true;
+  }
+
+  return false;
+}
+
+static bool
+process_prepared_contour (glyphy_arc_list_t         *arc_list,
+			  unsigned int               start,
+			  unsigned int               end,
+			  bool                       inverse,
+			  std::vector<unsigned int> &indices)
+{
+  /* Same as process_contour(); keeps the prepared arcs up to date. */
+
+  glyphy_arc_endpoint_t *endpoints = &arc_list->endpoints[0] + start;
+  unsigned int num_endpoints = end - start;
+
+  if (!contour_is_closed (endpoints, num_endpoints))
+    return false;
+
   if (inverse ^
       winding (endpoints, num_endpoints) ^
-      even_odd (endpoints, num_endpoints, all_endpoints, num_all_endpoints))
+      even_odd_prepared (arc_list, start, end, indices))
   {
     glyphy_outline_reverse (endpoints, num_endpoints);
+    arc_list->update (start, end);
     return true;
   }
 
@@ -313,15 +616,267 @@ glyphy_outline_winding_from_even_odd (glyphy_arc_endpoint_t *endpoints,
    * - Process one contour at a time.
    */
 
+  OutlineIndex index (endpoints, num_endpoints, NULL, 0);
+  bool ret = false;
+  for (unsigned int c = 0; c < index.contours.size (); c++)
+    ret = ret | process_contour (endpoints, index, c, bool (inverse));
+  return ret;
+}
+
+/* Below this many contours, starting threads costs more than it saves. */
+#define MIN_CONTOURS_TO_PARALLELIZE 16
+
+glyphy_bool_t
+glyphy_outline_winding_from_even_odd_parallel (glyphy_arc_endpoint_t *endpoints,
+					       unsigned int           num_endpoints,
+					       glyphy_bool_t          inverse)
+{
+  /*
+   * Algorithm:
+   *
+   * - Decide for every contour against the outline as passed in; each
+   *   decision only reads, so they can be made at the same time,
+   * - Then go through the contours in order, reversing the ones that
+   *   need it.  Done one at a time, a contour is decided against the
+   *   ones before it as already reversed.  Arcs ending on the halfline
+   *   count halves that change sign with the arc's direction, so decide
+   *   again if any of the contours looked at got reversed since.
+   */
+
+  OutlineIndex index (endpoints, num_endpoints, NULL, 0);
+  int num_contours = index.contours.size ();
+  std::vector<char> needs_reversing (num_contours);
+  std::vector<std::vector<unsigned int> > visited (num_contours);
+
+#ifdef _OPENMP
+#pragma omp parallel for if (num_contours >= MIN_CONTOURS_TO_PARALLELIZE) schedule (dynamic, 4)
+#endif
+  for (int c = 0; c < num_contours; c++)
+    needs_reversing[c] = contour_needs_reversing (endpoints, index, c, bool (inverse), NULL, &visited[c]);
+
+  bool ret = false;
+  for (int c = 0; c < num_contours; c++)
+  {
+    for (unsigned int k = 0; k < visited[c].size (); k++)
+      if (index.contours[visited[c][k]].reversed) {
+	needs_reversing[c] = contour_needs_reversing (endpoints, index, c, bool (inverse));
+	break;
+      }
+    if (needs_reversing[c]) {
+      reverse_contour (endpoints, index, c);
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+glyphy_bool_t
+glyphy_outline_winding_from_even_odd_contours (glyphy_arc_endpoint_t *endpoints,
+					       unsigned int           num_endpoints,
+					       glyphy_contour_t      *contours,
+					       unsigned int           num_contours,
+					       glyphy_bool_t          inverse)
+{
+  OutlineIndex index (endpoints, num_endpoints, contours, num_contours);
+  bool ret = false;
+  for (unsigned int c = 0; c < num_contours; c++)
+    if (process_contour (endpoints, index, c, bool (inverse), &contours[c])) {
+      contours[c].area = -contours[c].area;
+      ret = true;
+    }
+  return ret;
+}
+
+glyphy_bool_t
+glyphy_arc_list_winding_from_even_odd (glyphy_arc_list_t *arc_list,
+				       glyphy_bool_t      inverse)
+{
+  unsigned int num_endpoints = arc_list->endpoints.size ();
+  std::vector<unsigned int> indices;
+
   unsigned int start = 0;
   bool ret = false;
   for (unsigned int i = 1; i < num_endpoints; i++) {
-    const glyphy_arc_endpoint_t &endpoint = endpoints[i];
-    if (endpoint.d == GLYPHY_INFINITY) {
-      ret = ret | process_contour (endpoints + start, i - start, endpoints, num_endpoints, bool (inverse));
+    if (arc_list->endpoints[i].d == GLYPHY_INFINITY) {
+      ret = ret | process_prepared_contour (arc_list, start, i, bool (inverse), indices);
       start = i;
     }
   }
-  ret = ret | process_contour (endpoints + start, num_endpoints - start, endpoints, num_endpoints, bool (inverse));
+  if (num_endpoints)
+    ret = ret | process_prepared_contour (arc_list, start, num_endpoints, bool (inverse), indices);
   return ret;
 }
+
+
+
+/*
+ * Simplify
+ */
+
+/* An arc to replace a run of arcs with.  Inside is where the distance
+ * to it is to its inside, rather than to one of its ends. */
+struct MergedArc
+{
+  Arc arc;
+  bool straight;
+  Point center;
+  double radius;
+  Vector n0, n1; /* inside is (p - p0)·n0 >= 0 and (p - p1)·n1 <= 0 */
+
+  MergedArc (const Arc &a) :
+    arc (a), straight (fabs (a.d) < 1e-5),
+    center (0, 0), radius (0), n0 (0, 0), n1 (0, 0)
+  {
+    if (straight)
+      n0 = n1 = (a.p1 - a.p0).normalized ();
+    else {
+      center = a.center ();
+      radius = a.radius ();
+      Pair<Vector> t = a.tangents ();
+      n0 = t.first.normalized ();
+      n1 = t.second.normalized ();
+    }
+  }
+
+  bool inside (const Point &p) const
+  {
+    return (p - arc.p0) * n0 >= -GLYPHY_EPSILON && (p - arc.p1) * n1 <= GLYPHY_EPSILON;
+  }
+
+  double distance (const Point &p) const
+  {
+    if (straight)
+      return fabs ((p - arc.p0) * n0.ortho ());
+    return fabs ((p - center).len () - radius);
+  }
+};
+
+/* Adds the points of a where p·v is smallest and largest, other than
+ * its ends. */
+static void
+add_extremes (const Arc &a, const Vector &v, Point *points, unsigned int &num_points)
+{
+  if (fabs (a.d) < 1e-5 || v.len () == 0)
+    return;
+  Point center = a.center ();
+  Vector r = v.normalized () * a.radius ();
+  if (a.wedge_contains_point (center + r))
+    points[num_points++] = center + r;
+  if (a.wedge_contains_point (center - r))
+    points[num_points++] = center - r;
+}
+
+/* Farthest any point of a is from m, or infinity if some are outside. */
+static double
+max_distance (const Arc &a, const MergedArc &m)
+{
+  Point points[8] = {a.p0, a.p1, a.p0, a.p0, a.p0, a.p0, a.p0, a.p0};
+  unsigned int num_points = 2;
+
+  /* m's inside is convex, so a is in it if its extremes are. */
+  add_extremes (a, m.n0, points, num_points);
+  add_extremes (a, m.n1, points, num_points);
+  for (unsigned int i = 0; i < num_points; i++)
+    if (!m.inside (points[i]))
+      return GLYPHY_INFINITY;
+
+  num_points = 2;
+  if (m.straight)
+    add_extremes (a, m.n0.ortho (), points, num_points);
+  else if (fabs (a.d) >= 1e-5)
+    add_extremes (a, m.center - a.center (), points, num_points);
+  else {
+    /* Closest point of the segment to m's center */
+    Vector dp = a.p1 - a.p0;
+    double t = (m.center - a.p0) * dp / (dp * dp);
+    if (t > 0 && t < 1)
+      points[num_points++] = a.p0 + dp * t;
+  }
+
+  double e = 0;
+  for (unsigned int i = 0; i < num_points; i++)
+    e = std::max (e, m.distance (points[i]));
+  return e;
+}
+
+/* Tries to replace the arcs from start through run[0..num_run) with one,
+ * within tolerance; error is how far it is from them. */
+static bool
+merge_run (const Point &start,
+	   const glyphy_arc_endpoint_t *run,
+	   unsigned int num_run,
+	   double tolerance,
+	   double max_d,
+	   unsigned int d_bits,
+	   glyphy_arc_endpoint_t &merged,
+	   double &error)
+{
+  Point end = run[num_run - 1].p;
+  if (start == end)
+    return false;
+
+  Point pivot = run[num_run / 2 - (num_run % 2 ? 0 : 1)].p;
+  Arc arc (start, end, pivot, false);
+  arc.d = quantize_d (arc.d, max_d, d_bits);
+  if (!(fabs (arc.d) <= 1))
+    return false;
+  MergedArc m (arc);
+
+  double e = 0;
+  Point p0 = start;
+  for (unsigned int i = 0; i < num_run; i++) {
+    e = std::max (e, max_distance (Arc (p0, run[i].p, run[i].d), m));
+    if (e > tolerance)
+      return false;
+    p0 = run[i].p;
+  }
+
+  /* The run goes from one end of m to the other.  Staying this close,
+   * it can't reach the center nor loop around, so it passes every point
+   * of m at no more than e as well. */
+  if (!m.straight && !(e < m.radius && 2 * e < (end - start).len ()))
+    return false;
+
+  merged.p = end;
+  merged.d = arc.d;
+  error = e;
+  return true;
+}
+
+unsigned int
+glyphy_outline_simplify (glyphy_arc_endpoint_t *endpoints,
+			 unsigned int           num_endpoints,
+			 double                 tolerance,
+			 double                 max_d,
+			 double                 d_bits,
+			 double                *max_error)
+{
+  double max_e = 0;
+  unsigned int n = 0;
+  Point start (0, 0);
+  for (unsigned int i = 0; i < num_endpoints;)
+  {
+    if (endpoints[i].d == GLYPHY_INFINITY) {
+      start = endpoints[i].p;
+      endpoints[n++] = endpoints[i++];
+      continue;
+    }
+
+    /* Grow the run while one arc still covers it.  Runs only read
+     * endpoints at or after i, and n never passes i. */
+    glyphy_arc_endpoint_t merged = endpoints[i];
+    double e = 0;
+    unsigned int j = i + 1;
+    while (j < num_endpoints && endpoints[j].d != GLYPHY_INFINITY &&
+	   merge_run (start, endpoints + i, j + 1 - i, tolerance, max_d, d_bits, merged, e))
+      j++;
+
+    max_e = std::max (max_e, e);
+    endpoints[n++] = merged;
+    start = merged.p;
+    i = j;
+  }
+  if (max_error)
+    *max_error = max_e;
+  return n;
+}
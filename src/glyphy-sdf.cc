@@ -22,8 +22,16 @@
 
 #include "glyphy-common.hh"
 #include "glyphy-geometry.hh"
+#include "glyphy-arc-list.hh"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace GLyphy::Geometry;
+using namespace GLyphy::ArcList;
 
 /*
  * TODO
@@ -89,3 +97,707 @@ glyphy_sdf_from_arc_list (const glyphy_arc_endpoint_t *endpoints,
 
   return side * min_dist;
 }
+
+
+
+/*
+ * Batched SDF from arc list
+ *
+ * Same result as glyphy_sdf_from_arc_list(), up to rounding, for many
+ * points.  The points are spread over SIMD lanes and the arcs, prepared
+ * once (see glyphy-arc-list.hh), are broadcast; the lanes go through the
+ * arcs near them in lock-step doing the same min/side bookkeeping as the
+ * scalar loop.  The rare tie-breaking between arcs sharing a closest
+ * endpoint is done per lane.
+ */
+
+static inline double
+lanes_extended_dist (const std::vector<PreparedArc> &arcs, double closest, double x, double y)
+{
+  /* No closest arc yet; the scalar code uses a degenerate arc at the
+   * origin, whose extended distance is zero. */
+  return closest < 0 ? 0 : arcs[(unsigned int) closest].extended_dist (x, y);
+}
+
+template <typename Scalar>
+struct ScalarLanesT
+{
+  enum { N = 1 };
+  typedef Scalar S;
+  typedef Scalar V;
+  typedef bool M;
+
+  static inline V load (const S *p) { return *p; }
+  static inline void store (S *p, V v) { *p = v; }
+  static inline V set1 (S v) { return v; }
+
+  static inline V add (V a, V b) { return a + b; }
+  static inline V sub (V a, V b) { return a - b; }
+  static inline V mul (V a, V b) { return a * b; }
+  static inline V div (V a, V b) { return a / b; }
+  static inline V sqrt_ (V a) { return sqrt (a); }
+  static inline V abs_ (V a) { return fabs (a); }
+  static inline V min_ (V a, V b) { return b < a ? b : a; }
+
+  static inline M lt (V a, V b) { return a < b; }
+  static inline M le (V a, V b) { return a <= b; }
+  static inline M eq (V a, V b) { return a == b; }
+  static inline M and_ (M a, M b) { return a && b; }
+  static inline M or_ (M a, M b) { return a || b; }
+  static inline M andnot (M a, M b) { return a && !b; }
+  static inline M not_ (M a) { return !a; }
+  static inline V select (M m, V a, V b) { return m ? a : b; }
+  static inline int bits (M m) { return m; }
+};
+typedef ScalarLanesT<double> ScalarLanes;
+typedef ScalarLanesT<float> ScalarLanes32;
+
+#if defined(__AVX__)
+struct SimdLanes
+{
+  enum { N = 4 };
+  typedef double S;
+  typedef __m256d V;
+  typedef __m256d M;
+
+  static inline V load (const double *p) { return _mm256_loadu_pd (p); }
+  static inline void store (double *p, V v) { _mm256_storeu_pd (p, v); }
+  static inline V set1 (double v) { return _mm256_set1_pd (v); }
+
+  static inline V add (V a, V b) { return _mm256_add_pd (a, b); }
+  static inline V sub (V a, V b) { return _mm256_sub_pd (a, b); }
+  static inline V mul (V a, V b) { return _mm256_mul_pd (a, b); }
+  static inline V div (V a, V b) { return _mm256_div_pd (a, b); }
+  static inline V sqrt_ (V a) { return _mm256_sqrt_pd (a); }
+  static inline V abs_ (V a) { return _mm256_andnot_pd (_mm256_set1_pd (-0.), a); }
+  static inline V min_ (V a, V b) { return _mm256_min_pd (a, b); }
+
+  static inline M lt (V a, V b) { return _mm256_cmp_pd (a, b, _CMP_LT_OQ); }
+  static inline M le (V a, V b) { return _mm256_cmp_pd (a, b, _CMP_LE_OQ); }
+  static inline M eq (V a, V b) { return _mm256_cmp_pd (a, b, _CMP_EQ_OQ); }
+  static inline M and_ (M a, M b) { return _mm256_and_pd (a, b); }
+  static inline M or_ (M a, M b) { return _mm256_or_pd (a, b); }
+  static inline M andnot (M a, M b) { return _mm256_andnot_pd (b, a); }
+  static inline M not_ (M a) { return _mm256_xor_pd (a, _mm256_castsi256_pd (_mm256_set1_epi64x (-1))); }
+  static inline V select (M m, V a, V b) { return _mm256_blendv_pd (b, a, m); }
+  static inline int bits (M m) { return _mm256_movemask_pd (m); }
+};
+
+struct SimdLanes32
+{
+  enum { N = 8 };
+  typedef float S;
+  typedef __m256 V;
+  typedef __m256 M;
+
+  static inline V load (const float *p) { return _mm256_loadu_ps (p); }
+  static inline void store (float *p, V v) { _mm256_storeu_ps (p, v); }
+  static inline V set1 (float v) { return _mm256_set1_ps (v); }
+
+  static inline V add (V a, V b) { return _mm256_add_ps (a, b); }
+  static inline V sub (V a, V b) { return _mm256_sub_ps (a, b); }
+  static inline V mul (V a, V b) { return _mm256_mul_ps (a, b); }
+  static inline V div (V a, V b) { return _mm256_div_ps (a, b); }
+  static inline V sqrt_ (V a) { return _mm256_sqrt_ps (a); }
+  static inline V abs_ (V a) { return _mm256_andnot_ps (_mm256_set1_ps (-0.f), a); }
+  static inline V min_ (V a, V b) { return _mm256_min_ps (a, b); }
+
+  static inline M lt (V a, V b) { return _mm256_cmp_ps (a, b, _CMP_LT_OQ); }
+  static inline M le (V a, V b) { return _mm256_cmp_ps (a, b, _CMP_LE_OQ); }
+  static inline M eq (V a, V b) { return _mm256_cmp_ps (a, b, _CMP_EQ_OQ); }
+  static inline M and_ (M a, M b) { return _mm256_and_ps (a, b); }
+  static inline M or_ (M a, M b) { return _mm256_or_ps (a, b); }
+  static inline M andnot (M a, M b) { return _mm256_andnot_ps (b, a); }
+  static inline M not_ (M a) { return _mm256_xor_ps (a, _mm256_castsi256_ps (_mm256_set1_epi32 (-1))); }
+  static inline V select (M m, V a, V b) { return _mm256_blendv_ps (b, a, m); }
+  static inline int bits (M m) { return _mm256_movemask_ps (m); }
+};
+#elif defined(__SSE2__)
+struct SimdLanes
+{
+  enum { N = 2 };
+  typedef double S;
+  typedef __m128d V;
+  typedef __m128d M;
+
+  static inline V load (const double *p) { return _mm_loadu_pd (p); }
+  static inline void store (double *p, V v) { _mm_storeu_pd (p, v); }
+  static inline V set1 (double v) { return _mm_set1_pd (v); }
+
+  static inline V add (V a, V b) { return _mm_add_pd (a, b); }
+  static inline V sub (V a, V b) { return _mm_sub_pd (a, b); }
+  static inline V mul (V a, V b) { return _mm_mul_pd (a, b); }
+  static inline V div (V a, V b) { return _mm_div_pd (a, b); }
+  static inline V sqrt_ (V a) { return _mm_sqrt_pd (a); }
+  static inline V abs_ (V a) { return _mm_andnot_pd (_mm_set1_pd (-0.), a); }
+  static inline V min_ (V a, V b) { return _mm_min_pd (a, b); }
+
+  static inline M lt (V a, V b) { return _mm_cmplt_pd (a, b); }
+  static inline M le (V a, V b) { return _mm_cmple_pd (a, b); }
+  static inline M eq (V a, V b) { return _mm_cmpeq_pd (a, b); }
+  static inline M and_ (M a, M b) { return _mm_and_pd (a, b); }
+  static inline M or_ (M a, M b) { return _mm_or_pd (a, b); }
+  static inline M andnot (M a, M b) { return _mm_andnot_pd (b, a); }
+  static inline M not_ (M a) { return _mm_xor_pd (a, _mm_castsi128_pd (_mm_set1_epi32 (-1))); }
+  static inline V select (M m, V a, V b) { return _mm_or_pd (_mm_and_pd (m, a), _mm_andnot_pd (m, b)); }
+  static inline int bits (M m) { return _mm_movemask_pd (m); }
+};
+
+struct SimdLanes32
+{
+  enum { N = 4 };
+  typedef float S;
+  typedef __m128 V;
+  typedef __m128 M;
+
+  static inline V load (const float *p) { return _mm_loadu_ps (p); }
+  static inline void store (float *p, V v) { _mm_storeu_ps (p, v); }
+  static inline V set1 (float v) { return _mm_set1_ps (v); }
+
+  static inline V add (V a, V b) { return _mm_add_ps (a, b); }
+  static inline V sub (V a, V b) { return _mm_sub_ps (a, b); }
+  static inline V mul (V a, V b) { return _mm_mul_ps (a, b); }
+  static inline V div (V a, V b) { return _mm_div_ps (a, b); }
+  static inline V sqrt_ (V a) { return _mm_sqrt_ps (a); }
+  static inline V abs_ (V a) { return _mm_andnot_ps (_mm_set1_ps (-0.f), a); }
+  static inline V min_ (V a, V b) { return _mm_min_ps (a, b); }
+
+  static inline M lt (V a, V b) { return _mm_cmplt_ps (a, b); }
+  static inline M le (V a, V b) { return _mm_cmple_ps (a, b); }
+  static inline M eq (V a, V b) { return _mm_cmpeq_ps (a, b); }
+  static inline M and_ (M a, M b) { return _mm_and_ps (a, b); }
+  static inline M or_ (M a, M b) { return _mm_or_ps (a, b); }
+  static inline M andnot (M a, M b) { return _mm_andnot_ps (b, a); }
+  static inline M not_ (M a) { return _mm_xor_ps (a, _mm_castsi128_ps (_mm_set1_epi32 (-1))); }
+  static inline V select (M m, V a, V b) { return _mm_or_ps (_mm_and_ps (m, a), _mm_andnot_ps (m, b)); }
+  static inline int bits (M m) { return _mm_movemask_ps (m); }
+};
+#else
+typedef ScalarLanes SimdLanes;
+typedef ScalarLanes32 SimdLanes32;
+#endif
+
+/* Evaluates L::N points, looking only at the given arcs.  Arcs are kept
+ * in double; lanes calculate in L::S. */
+template <typename L, typename P>
+static void
+sdf_from_prepared_arcs (const std::vector<PreparedArc>  &arcs,
+			const std::vector<unsigned int> &indices,
+			const P                         *points,
+			typename L::S                   *sdfs)
+{
+  typedef typename L::S S;
+  typedef typename L::V V;
+  typedef typename L::M M;
+
+  S xs[L::N], ys[L::N];
+  for (unsigned int i = 0; i < L::N; i++) {
+    xs[i] = points[i].x;
+    ys[i] = points[i].y;
+  }
+  const V px = L::load (xs), py = L::load (ys);
+
+  const V zero = L::set1 (0), one = L::set1 (1), minus_one = L::set1 (-1);
+  const V almost_one = L::set1 (1 - GLYPHY_EPSILON);
+  V min_dist = L::set1 (GLYPHY_INFINITY);
+  V side = zero;
+  V closest = minus_one;
+
+  unsigned int num_indices = indices.size ();
+  for (unsigned int k = 0; k < num_indices; k++)
+  {
+    unsigned int j = indices[k];
+    const PreparedArc &a = arcs[j];
+
+    V dx0 = L::sub (px, L::set1 (a.arc.p0.x)), dy0 = L::sub (py, L::set1 (a.arc.p0.y));
+    V dx1 = L::sub (px, L::set1 (a.arc.p1.x)), dy1 = L::sub (py, L::set1 (a.arc.p1.y));
+
+    M in0 = L::le (zero, L::add (L::mul (dx0, L::set1 (a.tangents.first.dx)),
+				 L::mul (dy0, L::set1 (a.tangents.first.dy))));
+    M in1 = L::le (L::add (L::mul (dx1, L::set1 (a.tangents.second.dx)),
+			   L::mul (dy1, L::set1 (a.tangents.second.dy))), zero);
+    M wedge = a.wide ? L::or_ (in0, in1) : L::and_ (in0, in1);
+
+    if (L::bits (wedge))
+    {
+      V udist, wedge_side;
+      if (a.straight) {
+	/* Signed distance to line; positive means sdist >= 0 */
+	V sdist = L::div (L::sub (L::set1 (a.c), L::add (L::mul (L::set1 (a.n.dx), px),
+							  L::mul (L::set1 (a.n.dy), py))),
+			  L::set1 (a.nlen));
+	udist = L::abs_ (sdist);
+	wedge_side = L::select (L::le (zero, sdist), minus_one, one);
+      } else {
+	V cx = L::sub (px, L::set1 (a.center.x)), cy = L::sub (py, L::set1 (a.center.y));
+	V dc = L::sqrt_ (L::add (L::mul (cx, cx), L::mul (cy, cy)));
+	V r = L::set1 (a.radius);
+	M inside;
+	if (sizeof (S) == sizeof (double)) {
+	  udist = L::abs_ (L::sub (dc, r));
+	  inside = L::lt (dc, r);
+	} else {
+	  /* Flat arcs have huge radii, and dc - r loses all precision in
+	   * single.  Use (dc² - r²) / (dc + r) instead, with dc² - r² as
+	   * |p-p0|² + 2 (p-p0)·(p0-center), whose error is small next to
+	   * dc + r. */
+	  V ux = L::set1 (2 * (a.arc.p0.x - a.center.x)), uy = L::set1 (2 * (a.arc.p0.y - a.center.y));
+	  V f = L::add (L::mul (dx0, L::add (dx0, ux)), L::mul (dy0, L::add (dy0, uy)));
+	  udist = L::div (L::abs_ (f), L::add (dc, r));
+	  inside = L::lt (f, zero);
+	}
+	M negative = a.arc.d < 0 ? L::not_ (inside) : inside;
+	wedge_side = L::select (L::andnot (negative, L::eq (udist, zero)), one, minus_one);
+      }
+      udist = L::mul (udist, almost_one);
+
+      M update = L::and_ (wedge, L::le (udist, min_dist));
+      min_dist = L::select (update, udist, min_dist);
+      side = L::select (update, wedge_side, side);
+    }
+
+    if (L::bits (wedge) != L::bits (L::eq (zero, zero)))
+    {
+      M outside = L::not_ (wedge);
+      V udist = L::min_ (L::sqrt_ (L::add (L::mul (dx0, dx0), L::mul (dy0, dy0))),
+			 L::sqrt_ (L::add (L::mul (dx1, dx1), L::mul (dy1, dy1))));
+
+      M closer = L::and_ (outside, L::lt (udist, min_dist));
+      M tie = L::and_ (L::andnot (outside, closer),
+		       L::and_ (L::eq (side, zero), L::eq (udist, min_dist)));
+
+      min_dist = L::select (closer, udist, min_dist);
+      side = L::select (closer, zero, side);
+      closest = L::select (closer, L::set1 (j), closest);
+
+      int tie_bits = L::bits (tie);
+      if (tie_bits)
+      {
+	/* Compare extended distances.  Take the sign from the arc
+	 * with larger extended distance. */
+	S sides[L::N], closests[L::N];
+	L::store (sides, side);
+	L::store (closests, closest);
+	for (unsigned int i = 0; i < L::N; i++)
+	  if (tie_bits & (1 << i))
+	  {
+	    double old_ext_dist = lanes_extended_dist (arcs, closests[i], xs[i], ys[i]);
+	    double new_ext_dist = a.extended_dist (xs[i], ys[i]);
+	    double ext_dist = fabs (new_ext_dist) <= fabs (old_ext_dist) ?
+			      old_ext_dist : new_ext_dist;
+	    sides[i] = ext_dist >= 0 ? +1 : -1;
+	  }
+	side = L::load (sides);
+      }
+    }
+  }
+
+  S min_dists[L::N], sides[L::N], closests[L::N];
+  L::store (min_dists, min_dist);
+  L::store (sides, side);
+  L::store (closests, closest);
+  for (unsigned int i = 0; i < L::N; i++)
+  {
+    if (sides[i] == 0) {
+      double ext_dist = lanes_extended_dist (arcs, closests[i], xs[i], ys[i]);
+      sides[i] = ext_dist >= 0 ? +1 : -1;
+    }
+    sdfs[i] = sides[i] * min_dists[i];
+  }
+}
+
+/* Going through all arcs beats culling for lists this short. */
+#ifndef GLYPHY_MIN_ARCS_TO_CULL
+#define GLYPHY_MIN_ARCS_TO_CULL 64
+#endif
+
+/* Arcs that can affect the SDF at the given points.  Each point is at most
+ * its nearest endpoint distance away from the closest arc, and no arc is
+ * closer to it than its extents are, save for the (1 - EPSILON) applied to
+ * wedge distances. */
+template <typename P>
+static inline void
+candidate_arcs (const glyphy_arc_list_t   *arc_list,
+		const P                   *points,
+		unsigned int               num_points,
+		std::vector<unsigned int> &indices)
+{
+  unsigned int num_arcs = arc_list->arcs.size ();
+  if (num_arcs < GLYPHY_MIN_ARCS_TO_CULL) {
+    indices.resize (num_arcs);
+    for (unsigned int i = 0; i < num_arcs; i++)
+      indices[i] = i;
+    return;
+  }
+
+  glyphy_extents_t box;
+  glyphy_extents_clear (&box);
+  double bound = 0;
+  for (unsigned int i = 0; i < num_points; i++) {
+    Point p (points[i].x, points[i].y);
+    glyphy_extents_add (&box, &p);
+    bound = std::max (bound, arc_list->tree.nearest_endpoint_distance (arc_list->arcs, p));
+  }
+
+  double pad = bound * (1 + 2 * GLYPHY_EPSILON) + GLYPHY_EPSILON;
+  box.min_x -= pad; box.min_y -= pad;
+  box.max_x += pad; box.max_y += pad;
+  arc_list->tree.query (arc_list->arcs, box, indices);
+}
+
+static double
+sdf_from_prepared_arc_list (const glyphy_arc_list_t        *arc_list,
+			    const std::vector<unsigned int> &indices,
+			    const Point                     &c)
+{
+  /* Same as glyphy_sdf_from_arc_list(), with cached arc parameters. */
+  const PreparedArc *closest_arc = NULL;
+  double min_dist = GLYPHY_INFINITY;
+  int side = 0;
+  for (unsigned int k = 0; k < indices.size (); k++) {
+    const PreparedArc &arc = arc_list->arcs[indices[k]];
+
+    if (arc.wedge_contains_point (c)) {
+      double sdist;
+      if (arc.straight)
+	sdist = Segment (arc.arc.p0, arc.arc.p1).distance_to_point (c);
+      else {
+	double dc = c.distance_to_point (arc.center);
+	sdist = fabs (dc - arc.radius) * (((dc < arc.radius) ^ (arc.arc.d < 0)) ? -1 : 1);
+      }
+      double udist = fabs (sdist) * (1 - GLYPHY_EPSILON);
+      if (udist <= min_dist) {
+        min_dist = udist;
+	side = sdist >= 0 ? -1 : +1;
+      }
+    } else {
+      double udist = std::min ((arc.arc.p0 - c).len (), (arc.arc.p1 - c).len ());
+      if (udist < min_dist) {
+        min_dist = udist;
+	side = 0; /* unsure */
+	closest_arc = &arc;
+      } else if (side == 0 && udist == min_dist) {
+	double old_ext_dist = closest_arc ? closest_arc->extended_dist (c.x, c.y) : 0;
+	double new_ext_dist = arc.extended_dist (c.x, c.y);
+
+	double ext_dist = fabs (new_ext_dist) <= fabs (old_ext_dist) ?
+			  old_ext_dist : new_ext_dist;
+
+	side = ext_dist >= 0 ? +1 : -1;
+      }
+    }
+  }
+
+  if (side == 0) {
+    double ext_dist = closest_arc ? closest_arc->extended_dist (c.x, c.y) : 0;
+    side = ext_dist >= 0 ? +1 : -1;
+  }
+
+  return side * min_dist;
+}
+
+double
+glyphy_arc_list_sdf (glyphy_arc_list_t    *arc_list,
+		     const glyphy_point_t *p)
+{
+  std::vector<unsigned int> &indices = arc_list->indices;
+  candidate_arcs (arc_list, p, 1, indices);
+  return sdf_from_prepared_arc_list (arc_list, indices, *p);
+}
+
+/* Full groups of L::N points, then the rest one at a time in L1. */
+template <typename L, typename L1, typename P>
+static void
+arc_list_sdf_batch (glyphy_arc_list_t *arc_list,
+		    const P           *points,
+		    unsigned int       num_points,
+		    typename L::S     *sdfs)
+{
+  std::vector<unsigned int> &indices = arc_list->indices;
+  unsigned int i = 0;
+  for (; i + L::N <= num_points; i += L::N) {
+    candidate_arcs (arc_list, points + i, L::N, indices);
+    sdf_from_prepared_arcs<L> (arc_list->arcs, indices, points + i, sdfs + i);
+  }
+  for (; i < num_points; i++) {
+    candidate_arcs (arc_list, points + i, 1, indices);
+    sdf_from_prepared_arcs<L1> (arc_list->arcs, indices, points + i, sdfs + i);
+  }
+}
+
+void
+glyphy_arc_list_sdf_batch (glyphy_arc_list_t    *arc_list,
+			   const glyphy_point_t *points,
+			   unsigned int          num_points,
+			   double               *sdfs)
+{
+  arc_list_sdf_batch<SimdLanes, ScalarLanes> (arc_list, points, num_points, sdfs);
+}
+
+void
+glyphy_arc_list_sdf32_batch (glyphy_arc_list_t      *arc_list,
+			     const glyphy_point32_t *points,
+			     unsigned int            num_points,
+			     float                  *sdfs)
+{
+  arc_list_sdf_batch<SimdLanes32, ScalarLanes32> (arc_list, points, num_points, sdfs);
+}
+
+void
+glyphy_sdf_from_arc_list_batch (const glyphy_arc_endpoint_t *endpoints,
+				unsigned int                 num_endpoints,
+				const glyphy_point_t        *points,
+				unsigned int                 num_points,
+				double                      *sdfs)
+{
+  glyphy_arc_list_t *arc_list = glyphy_arc_list_create (endpoints, num_endpoints);
+  glyphy_arc_list_sdf_batch (arc_list, points, num_points, sdfs);
+  glyphy_arc_list_destroy (arc_list);
+}
+
+void
+glyphy_sdf_from_arc_list32_batch (const glyphy_arc_endpoint32_t *endpoints,
+				  unsigned int                   num_endpoints,
+				  const glyphy_point32_t        *points,
+				  unsigned int                   num_points,
+				  float                         *sdfs)
+{
+  glyphy_arc_list_t *arc_list = glyphy_arc_list_create32 (endpoints, num_endpoints);
+  glyphy_arc_list_sdf32_batch (arc_list, points, num_points, sdfs);
+  glyphy_arc_list_destroy (arc_list);
+}
+
+
+/*
+ * SDF from encoded blob
+ *
+ * This mirrors glyphy_sdf() in glyphy-sdf.glsl (and the decoding helpers
+ * in glyphy-common.glsl) step by step, so it sees exactly what the GPU
+ * sees, quantization, single-line cells, endpoint cap and all.  It
+ * calculates in double precision though.
+ */
+
+struct BlobArcList
+{
+  int num_endpoints; /* -1 for single line */
+  int side;
+  unsigned int offset;
+  double line_angle;
+  double line_distance;
+};
+
+static inline unsigned int
+blob_cell_offset (const Point &p, unsigned int nominal_width, unsigned int nominal_height)
+{
+  double x = std::max (0., std::min ((double) nominal_width  - 1, floor (p.x)));
+  double y = std::max (0., std::min ((double) nominal_height - 1, floor (p.y)));
+  return (unsigned int) y * nominal_width + (unsigned int) x;
+}
+
+static inline BlobArcList
+blob_arc_list_decode (const glyphy_rgba_t &v, unsigned int nominal_width, unsigned int nominal_height)
+{
+  BlobArcList l;
+  l.side = 0; /* unsure */
+  if (v.r == 0) { /* arc-list encoded */
+    l.offset = (v.g * 256) + v.b;
+    l.num_endpoints = v.a;
+    if (l.num_endpoints == 255) {
+      l.num_endpoints = 0;
+      l.side = -1;
+    } else if (l.num_endpoints == 0)
+      l.side = +1;
+  } else { /* single line encoded */
+    l.num_endpoints = -1;
+    l.offset = 0;
+    l.line_distance = double (((v.r - 128) * 256 + v.g) - 0x4000) / double (0x1FFF)
+		    * std::max (nominal_width, nominal_height);
+    l.line_angle = double (-((v.b * 256 + v.a) - 0x8000)) / double (0x7FFF) * M_PI;
+  }
+  return l;
+}
+
+static inline glyphy_arc_endpoint_t
+blob_arc_endpoint_decode (const glyphy_rgba_t &v, unsigned int nominal_width, unsigned int nominal_height)
+{
+  /* The shader sees normalized bytes, hence the 255s. */
+  Point p (((v.a >> 4) + v.g / 255.) / 16. * nominal_width,
+	   ((v.a & 15) + v.b / 255.) / 16. * nominal_height);
+  double d = v.r == 0 ? GLYPHY_INFINITY : (v.r - 128) * GLYPHY_MAX_D / 127;
+  glyphy_arc_endpoint_t endpoint = {p, d};
+  return endpoint;
+}
+
+static inline double
+sign (double v)
+{
+  return v > 0 ? +1. : v < 0 ? -1. : 0.;
+}
+
+static inline bool
+shader_wedge_contains (const Arc &a, const Point &p)
+{
+  double d2 = tan2atan (a.d);
+  Vector v = a.p1 - a.p0;
+  return (p - a.p0) * Vector (v.dx + d2 * v.dy, v.dy - d2 * v.dx) >= 0 &&
+	 (p - a.p1) * Vector (v.dx - d2 * v.dy, v.dy + d2 * v.dx) <= 0;
+}
+
+static inline double
+shader_wedge_signed_dist_shallow (const Arc &a, const Point &p)
+{
+  Vector v = (a.p1 - a.p0).normalized ();
+  double line_d = (p - a.p0) * v.ortho ();
+  if (a.d == 0)
+    return line_d;
+
+  double d0 = (p - a.p0) * v;
+  if (d0 < 0)
+    return sign (line_d) * (p - a.p0).len ();
+  double d1 = (a.p1 - p) * v;
+  if (d1 < 0)
+    return sign (line_d) * (p - a.p1).len ();
+  double r = 2 * a.d * (d0 * d1) / (d0 + d1);
+  if (r * line_d > 0)
+    return sign (line_d) * std::min (fabs (line_d + r), std::min ((p - a.p0).len (), (p - a.p1).len ()));
+  return line_d + r;
+}
+
+static inline double
+shader_wedge_signed_dist (const Arc &a, const Point &p)
+{
+  if (fabs (a.d) <= .03)
+    return shader_wedge_signed_dist_shallow (a, p);
+  Point c = a.center ();
+  return sign (a.d) * ((a.p0 - c).len () - (p - c).len ());
+}
+
+static inline double
+shader_extended_dist (const Arc &a, const Point &p)
+{
+  /* Note: this doesn't handle points inside the wedge. */
+  Point m = a.p0.midpoint (a.p1);
+  double d2 = tan2atan (a.d);
+  Vector v = a.p1 - a.p0;
+  if ((p - m) * (a.p1 - m) < 0)
+    return (p - a.p0) * Vector (d2 * v.dx - v.dy, v.dx + d2 * v.dy).normalized ();
+  else
+    return (p - a.p1) * Vector (-d2 * v.dx - v.dy, v.dx - d2 * v.dy).normalized ();
+}
+
+static double
+sdf_from_blob (const glyphy_rgba_t *blob,
+	       unsigned int         nominal_width,
+	       unsigned int         nominal_height,
+	       const Point         &p)
+{
+  BlobArcList arc_list = blob_arc_list_decode (blob[blob_cell_offset (p, nominal_width, nominal_height)],
+					       nominal_width, nominal_height);
+
+  /* Short-circuits */
+  if (arc_list.num_endpoints == 0) {
+    /* far-away cell */
+    return GLYPHY_INFINITY * arc_list.side;
+  } if (arc_list.num_endpoints == -1) {
+    /* single-line */
+    double angle = arc_list.line_angle;
+    Vector n (cos (angle), sin (angle));
+    return (p - Point (nominal_width * .5, nominal_height * .5)) * n - arc_list.line_distance;
+  }
+
+  double side = arc_list.side;
+  double min_dist = GLYPHY_INFINITY;
+  Arc closest_arc (p, p, 0);
+
+  glyphy_arc_endpoint_t endpoint_prev, endpoint;
+  endpoint_prev = blob_arc_endpoint_decode (blob[arc_list.offset], nominal_width, nominal_height);
+  for (int i = 1; i < GLYPHY_MAX_NUM_ENDPOINTS; i++)
+  {
+    if (i >= arc_list.num_endpoints)
+      break;
+    endpoint = blob_arc_endpoint_decode (blob[arc_list.offset + i], nominal_width, nominal_height);
+    Arc a (endpoint_prev.p, endpoint.p, endpoint.d);
+    endpoint_prev = endpoint;
+    if (isinf (a.d)) continue;
+
+    if (shader_wedge_contains (a, p))
+    {
+      double sdist = shader_wedge_signed_dist (a, p);
+      double udist = fabs (sdist) * (1 - GLYPHY_EPSILON);
+      if (udist <= min_dist) {
+	min_dist = udist;
+	side = sdist <= 0 ? -1 : +1;
+      }
+    } else {
+      double udist = std::min ((p - a.p0).len (), (p - a.p1).len ());
+      if (udist < min_dist) {
+	min_dist = udist;
+	side = 0; /* unsure */
+	closest_arc = a;
+      } else if (side == 0 && udist == min_dist) {
+	/* If this new distance is the same as the current minimum,
+	 * compare extended distances.  Take the sign from the arc
+	 * with larger extended distance. */
+	double old_ext_dist = shader_extended_dist (closest_arc, p);
+	double new_ext_dist = shader_extended_dist (a, p);
+
+	double ext_dist = fabs (new_ext_dist) <= fabs (old_ext_dist) ?
+			  old_ext_dist : new_ext_dist;
+
+	side = sign (ext_dist);
+      }
+    }
+  }
+
+  if (side == 0) {
+    // Technically speaking this should not happen, but it does.  So try to fix it.
+    double ext_dist = shader_extended_dist (closest_arc, p);
+    side = sign (ext_dist);
+  }
+
+  return min_dist * side;
+}
+
+double
+glyphy_sdf_from_blob (const glyphy_rgba_t  *blob,
+		      unsigned int          nominal_width,
+		      unsigned int          nominal_height,
+		      const glyphy_point_t *p)
+{
+  return sdf_from_blob (blob, nominal_width, nominal_height, *p);
+}
+
+void
+glyphy_sdf_from_blob_batch (const glyphy_rgba_t  *blob,
+			    unsigned int          nominal_width,
+			    unsigned int          nominal_height,
+			    const glyphy_point_t *points,
+			    unsigned int          num_points,
+			    double               *sdfs)
+{
+  for (unsigned int i = 0; i < num_points; i++)
+    sdfs[i] = sdf_from_blob (blob, nominal_width, nominal_height, points[i]);
+}
+
+unsigned int
+glyphy_arc_list_decode_blob (const glyphy_rgba_t   *blob,
+			     unsigned int           nominal_width,
+			     unsigned int           nominal_height,
+			     const glyphy_point_t  *p,
+			     glyphy_arc_endpoint_t *endpoints,
+			     unsigned int           max_endpoints)
+{
+  BlobArcList arc_list = blob_arc_list_decode (blob[blob_cell_offset (*p, nominal_width, nominal_height)],
+					       nominal_width, nominal_height);
+  if (arc_list.num_endpoints <= 0)
+    return 0;
+
+  unsigned int num_endpoints = arc_list.num_endpoints;
+  for (unsigned int i = 0; i < num_endpoints && i < max_endpoints; i++)
+    endpoints[i] = blob_arc_endpoint_decode (blob[arc_list.offset + i], nominal_width, nominal_height);
+  /* The shader never reads the first d; lists often start in the middle
+   * of a run that was encoded for another cell, so it is no move-to. */
+  if (max_endpoints)
+    endpoints[0].d = GLYPHY_INFINITY;
+  return num_endpoints;
+}
@@ -38,6 +38,13 @@ typedef struct {
   double y;
 } glyphy_point_t;
 
+/* Half the size, for storing many.  Plenty for coordinates that end up
+ * in 12 bits anyway. */
+typedef struct {
+  float x;
+  float y;
+} glyphy_point32_t;
+
 
 
 /*
@@ -160,6 +167,12 @@ typedef struct {
   double d;
 } glyphy_arc_endpoint_t;
 
+/* Same, in single precision; see glyphy_point32_t. */
+typedef struct {
+  glyphy_point32_t p;
+  float d;
+} glyphy_arc_endpoint32_t;
+
 typedef glyphy_bool_t (*glyphy_arc_endpoint_accumulator_callback_t) (glyphy_arc_endpoint_t *endpoint,
 								     void                  *user_data);
 
@@ -199,6 +212,24 @@ glyphy_arc_accumulator_get_callback (glyphy_arc_accumulator_t  *acc,
 				     glyphy_arc_endpoint_accumulator_callback_t *callback,
 				     void                     **user_data);
 
+/* Store endpoints in buffer instead of passing them to a callback;
+ * accumulation fails once buffer_size endpoints don't fit.  With a NULL
+ * buffer, acc grows a buffer of its own.  That is also what happens when
+ * no callback is set.  Either way, glyphy_arc_accumulator_get_endpoints()
+ * returns the results.  Setting a callback turns this off. */
+void
+glyphy_arc_accumulator_set_buffer (glyphy_arc_accumulator_t *acc,
+				   glyphy_arc_endpoint_t    *buffer,
+				   unsigned int              buffer_size);
+
+/* Same, storing endpoints in single precision.  Approximation is still
+ * done in double; endpoints are rounded as they are stored.
+ * glyphy_arc_accumulator_get_endpoints() returns NULL then. */
+void
+glyphy_arc_accumulator_set_buffer32 (glyphy_arc_accumulator_t *acc,
+				     glyphy_arc_endpoint32_t  *buffer,
+				     unsigned int              buffer_size);
+
 void
 glyphy_arc_accumulator_set_d_metrics (glyphy_arc_accumulator_t *acc,
 				      double                    max_d,
@@ -209,6 +240,66 @@ glyphy_arc_accumulator_get_d_metrics (glyphy_arc_accumulator_t *acc,
 				      double                   *max_d,
 				      double                   *d_bits);
 
+/* Measure how far arcs are from the curves instead of estimating it.
+ * Many times slower, but the tighter figures let longer arcs through,
+ * so fewer endpoints come out.  Meant for offline use.  Off by default. */
+void
+glyphy_arc_accumulator_set_measure_error (glyphy_arc_accumulator_t *acc,
+					  glyphy_bool_t             measure_error);
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_measure_error (glyphy_arc_accumulator_t *acc);
+
+/* Merge runs of arcs in each contour as it is closed, as
+ * glyphy_outline_simplify() does.  Curves are then fit to an eighth of
+ * the tolerance, and a contour's merged arcs get what its arcs leave of
+ * it, so the outline stays within tolerance of the original curves.  Only
+ * has an effect when acc stores double-precision endpoints, itself or in
+ * a buffer.  Off by default. */
+void
+glyphy_arc_accumulator_set_simplify (glyphy_arc_accumulator_t *acc,
+				     glyphy_bool_t             simplify);
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_simplify (glyphy_arc_accumulator_t *acc);
+
+/* Account for endpoints being rounded later to a steps x steps grid
+ * over extents, as glyphy_arc_list_encode_blob() does with the extents
+ * it reports and 4095 steps.  Errors then include the most that rounding
+ * can move the arcs, and curves get enough arcs to stay within tolerance
+ * after it.  Only the cell size matters, so the extents from encoding an
+ * earlier, plain accumulation of the glyph will do.  NULL extents turn
+ * it off, which is the default. */
+void
+glyphy_arc_accumulator_set_snap_grid (glyphy_arc_accumulator_t *acc,
+				      const glyphy_extents_t   *extents,
+				      unsigned int              steps);
+
+/* Cell size of the grid; zeros if off. */
+void
+glyphy_arc_accumulator_get_snap_grid (glyphy_arc_accumulator_t *acc,
+				      double                   *step_x,
+				      double                   *step_y);
+
+/* Also accumulate the outline at each of the given tolerances, as extra
+ * levels of detail, in the same pass.  Where a coarser level's arcs for
+ * a curve meet a finer level's tolerance, it gets the same ones.  Each
+ * level is an accumulator of its own, for results and output settings;
+ * by default it keeps its endpoints itself.  Other settings follow acc.
+ * Replaces any previous levels. */
+void
+glyphy_arc_accumulator_set_lod_tolerances (glyphy_arc_accumulator_t *acc,
+					   const double             *tolerances,
+					   unsigned int              num_levels);
+
+unsigned int
+glyphy_arc_accumulator_get_num_lods (glyphy_arc_accumulator_t *acc);
+
+/* Owned by acc; NULL if there's no such level. */
+glyphy_arc_accumulator_t *
+glyphy_arc_accumulator_get_lod (glyphy_arc_accumulator_t *acc,
+				unsigned int              level);
+
 
 /* Accumulation results */
 
@@ -221,6 +312,65 @@ glyphy_arc_accumulator_get_error (glyphy_arc_accumulator_t *acc);
 glyphy_bool_t
 glyphy_arc_accumulator_successful (glyphy_arc_accumulator_t *acc);
 
+/* What went into accumulating since the last reset, for finding the
+ * outlines that are slow to approximate.  Covers the levels of detail
+ * too; theirs are left at zero. */
+typedef struct {
+  unsigned int num_lines;
+  unsigned int num_conics;
+  unsigned int num_cubics;
+  unsigned int num_arcs; /* passed to glyphy_arc_accumulator_arc_to() */
+
+  unsigned int num_calc_arcs; /* times arcs were fit to a curve or part of one */
+  unsigned int num_jiggles; /* rounds of moving arc ends to even out errors */
+  unsigned int num_jiggle_overflows; /* times that gave up before it settled */
+  unsigned int num_degenerate; /* curves with no area, made a line or skipped */
+  unsigned int max_n; /* most arcs tried for a curve */
+
+  /* Spent approximating curves; only counted if the library is built
+   * with GLYPHY_ACCUMULATOR_TIMING defined, zero otherwise. */
+  unsigned long long nanoseconds;
+} glyphy_arc_accumulator_stats_t;
+
+void
+glyphy_arc_accumulator_get_stats (glyphy_arc_accumulator_t       *acc,
+				  glyphy_arc_accumulator_stats_t *stats);
+
+/* One contour of an accumulated outline: the move-to at endpoints[start]
+ * and the arcs following it.  Extents are those of its arcs, as from
+ * glyphy_arc_list_extents().  Area is what glyphy_outline_winding_from_even_odd()
+ * finds the contour direction from: twice the signed area, with arcs
+ * approximated by the triangles through their ends and middle.  It is
+ * negative for clockwise contours. */
+typedef struct {
+  unsigned int start;
+  unsigned int num_endpoints;
+  glyphy_extents_t extents;
+  double area;
+} glyphy_contour_t;
+
+/* Also record contours as endpoints are stored, saving later passes
+ * from scanning for move-tos to find them.  Off by default. */
+void
+glyphy_arc_accumulator_set_record_contours (glyphy_arc_accumulator_t *acc,
+					    glyphy_bool_t             record_contours);
+
+glyphy_bool_t
+glyphy_arc_accumulator_get_record_contours (glyphy_arc_accumulator_t *acc);
+
+/* Contours accumulated since the last reset, if recording them.  Valid
+ * until the next reset or accumulate call. */
+glyphy_contour_t *
+glyphy_arc_accumulator_get_contours (glyphy_arc_accumulator_t *acc,
+				     unsigned int             *num_contours);
+
+/* Endpoints accumulated since the last reset, when not using a callback.
+ * Valid until the next reset or accumulate call, and may be modified in
+ * place. */
+glyphy_arc_endpoint_t *
+glyphy_arc_accumulator_get_endpoints (glyphy_arc_accumulator_t *acc,
+				      unsigned int             *num_endpoints);
+
 
 /* Accumulate */
 
@@ -256,6 +406,46 @@ glyphy_arc_list_extents (const glyphy_arc_endpoint_t *endpoints,
 			 unsigned int                 num_endpoints,
 			 glyphy_extents_t            *extents);
 
+/* Same, from recorded contours */
+void
+glyphy_contour_list_extents (const glyphy_contour_t *contours,
+			     unsigned int            num_contours,
+			     glyphy_extents_t       *extents);
+
+
+
+/*
+ * Prepared arc lists, for repeated queries on the same outline
+ */
+
+/* A copy of an arc list with arc centers, radii, tangents and extents
+ * computed once, and a bounding-box hierarchy over the arcs. */
+typedef struct glyphy_arc_list_t glyphy_arc_list_t;
+
+glyphy_arc_list_t *
+glyphy_arc_list_create (const glyphy_arc_endpoint_t *endpoints,
+			unsigned int                 num_endpoints);
+
+glyphy_arc_list_t *
+glyphy_arc_list_create32 (const glyphy_arc_endpoint32_t *endpoints,
+			  unsigned int                   num_endpoints);
+
+void
+glyphy_arc_list_destroy (glyphy_arc_list_t *arc_list);
+
+glyphy_arc_list_t *
+glyphy_arc_list_reference (glyphy_arc_list_t *arc_list);
+
+
+const glyphy_arc_endpoint_t *
+glyphy_arc_list_get_endpoints (glyphy_arc_list_t *arc_list,
+			       unsigned int      *num_endpoints);
+
+/* Same as glyphy_arc_list_extents() */
+void
+glyphy_arc_list_get_extents (glyphy_arc_list_t *arc_list,
+			     glyphy_extents_t  *extents);
+
 
 
 /*
@@ -272,6 +462,45 @@ glyphy_outline_winding_from_even_odd (glyphy_arc_endpoint_t *endpoints,
 				      unsigned int           num_endpoints,
 				      glyphy_bool_t          inverse);
 
+/* Same as above, using contours recorded for the endpoints instead of
+ * looking for them.  Areas of reversed contours are negated to match. */
+glyphy_bool_t
+glyphy_outline_winding_from_even_odd_contours (glyphy_arc_endpoint_t *endpoints,
+					       unsigned int           num_endpoints,
+					       glyphy_contour_t      *contours,
+					       unsigned int           num_contours,
+					       glyphy_bool_t          inverse);
+
+/* Same as above, on the endpoints of a prepared arc list */
+glyphy_bool_t
+glyphy_arc_list_winding_from_even_odd (glyphy_arc_list_t *arc_list,
+				       glyphy_bool_t      inverse);
+
+/* Same as glyphy_outline_winding_from_even_odd(), deciding contours on
+ * multiple threads if the library is built with OpenMP.  Worth it for
+ * outlines with many contours. */
+glyphy_bool_t
+glyphy_outline_winding_from_even_odd_parallel (glyphy_arc_endpoint_t *endpoints,
+					       unsigned int           num_endpoints,
+					       glyphy_bool_t          inverse);
+
+/* Replaces runs of consecutive arcs with single arcs, where one stays
+ * within tolerance of the run; for example collinear lines, or arcs on
+ * nearly the same circle.  New arcs have d clamped and quantized to
+ * max_d and d_bits, as by glyphy_arc_accumulator_set_d_metrics().  The
+ * error adds to what the arcs already had against the original curves;
+ * max_error, if not NULL, is set to the most a new arc is from the arcs
+ * it replaced.  glyphy_arc_accumulator_set_simplify() keeps the sum within
+ * the accumulator tolerance.  Works in place; returns the new number of
+ * endpoints. */
+unsigned int
+glyphy_outline_simplify (glyphy_arc_endpoint_t *endpoints,
+			 unsigned int           num_endpoints,
+			 double                 tolerance,
+			 double                 max_d,
+			 double                 d_bits,
+			 double                *max_error);
+
 
 
 /*
@@ -287,8 +516,12 @@ typedef struct {
 } glyphy_rgba_t;
 
 
-/* TODO make this callback-based also? */
 /* TODO rename to glyphy_blob_encode? */
+/* The encoder picks the coarsest grid, up to 63x63, whose average number
+ * of texture fetches per cell does not exceed avg_fetch_desired, and
+ * returns it in nominal_width and nominal_height.  Returns false if the
+ * blob is longer than blob_size; output_len, the length it needs, is set
+ * either way. */
 glyphy_bool_t
 glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
 			     unsigned int                 num_endpoints,
@@ -302,7 +535,147 @@ glyphy_arc_list_encode_blob (const glyphy_arc_endpoint_t *endpoints,
 			     unsigned int                *nominal_height, /* 6bit */
 			     glyphy_extents_t            *extents);
 
-/* TBD _decode_blob */
+/* Same, from single-precision endpoints. */
+glyphy_bool_t
+glyphy_arc_list_encode_blob32 (const glyphy_arc_endpoint32_t *endpoints,
+			       unsigned int                   num_endpoints,
+			       glyphy_rgba_t                 *blob,
+			       unsigned int                   blob_size,
+			       double                         faraway,
+			       double                         avg_fetch_desired,
+			       double                        *avg_fetch_achieved,
+			       unsigned int                  *output_len,
+			       unsigned int                  *nominal_width,  /* 6bit */
+			       unsigned int                  *nominal_height, /* 6bit */
+			       glyphy_extents_t              *extents);
+
+/* Keeps the buffers encoding needs from one call to the next.  Encoding
+ * a font's glyphs with one encoder then stops allocating once they have
+ * grown big enough.  Not to be used from more than one thread at once. */
+typedef struct glyphy_blob_encoder_t glyphy_blob_encoder_t;
+
+glyphy_blob_encoder_t *
+glyphy_blob_encoder_create (void);
+
+void
+glyphy_blob_encoder_destroy (glyphy_blob_encoder_t *encoder);
+
+glyphy_blob_encoder_t *
+glyphy_blob_encoder_reference (glyphy_blob_encoder_t *encoder);
+
+/* Lets the encoder find the arc lists of grid cells on up to num_threads
+ * threads, if the library is built with OpenMP; zero leaves the count to
+ * OpenMP.  The default is one: encoding stays on the calling thread, for
+ * callers that already encode glyphs from several threads of their own.
+ * Blobs are the same whatever the count. */
+void
+glyphy_blob_encoder_set_num_threads (glyphy_blob_encoder_t *encoder,
+				     unsigned int           num_threads);
+
+unsigned int
+glyphy_blob_encoder_get_num_threads (glyphy_blob_encoder_t *encoder);
+
+/* Same as glyphy_arc_list_encode_blob().  The encoder remembers the last
+ * outline it encoded, and encoding that again only copies the blob out.
+ * To find out how long a blob is before allocating it, encode with a
+ * NULL blob and zero blob_size first. */
+glyphy_bool_t
+glyphy_blob_encoder_encode (glyphy_blob_encoder_t       *encoder,
+			    const glyphy_arc_endpoint_t *endpoints,
+			    unsigned int                 num_endpoints,
+			    glyphy_rgba_t               *blob,
+			    unsigned int                 blob_size,
+			    double                       faraway,
+			    double                       avg_fetch_desired,
+			    double                      *avg_fetch_achieved,
+			    unsigned int                *output_len,
+			    unsigned int                *nominal_width,  /* 6bit */
+			    unsigned int                *nominal_height, /* 6bit */
+			    glyphy_extents_t            *extents);
+
+/* Receives texels of a blob as encoding finishes them, to be stored at
+ * offset into the blob.  Every texel comes exactly once, but not in
+ * order.  Return false to not be passed any more. */
+typedef glyphy_bool_t (*glyphy_blob_sink_func_t) (const glyphy_rgba_t *texels,
+						  unsigned int         offset,
+						  unsigned int         num_texels,
+						  void                *user_data);
+
+/* Same as glyphy_blob_encoder_encode(), but passes the blob to sink
+ * instead of copying it into a buffer.  Returns false if sink stopped
+ * taking texels.  Encoding finishes and the other results are set either
+ * way, so encoding the same outline again only passes the blob on. */
+glyphy_bool_t
+glyphy_blob_encoder_encode_to_sink (glyphy_blob_encoder_t       *encoder,
+				    const glyphy_arc_endpoint_t *endpoints,
+				    unsigned int                 num_endpoints,
+				    glyphy_blob_sink_func_t      sink,
+				    void                        *user_data,
+				    double                       faraway,
+				    double                       avg_fetch_desired,
+				    double                      *avg_fetch_achieved,
+				    unsigned int                *output_len,
+				    unsigned int                *nominal_width,  /* 6bit */
+				    unsigned int                *nominal_height, /* 6bit */
+				    glyphy_extents_t            *extents);
+
+/* Same as glyphy_blob_encoder_encode(), but lays the blob out in rows
+ * of row_width texels, each starting stride texels after the one before
+ * it in region.  That is how a 2D texture atlas with row_width wide items
+ * stores it.  The rows used, returned in rows_used, are rounded up to a
+ * multiple of row_quantum; the texels after the blob in them are cleared.
+ * Returns false, with region possibly written to, if the blob does not
+ * fit in max_rows rows; rows_used is set either way.  Encoding the same
+ * outline again after finding more room only copies it out. */
+glyphy_bool_t
+glyphy_blob_encoder_encode_to_rows (glyphy_blob_encoder_t       *encoder,
+				    const glyphy_arc_endpoint_t *endpoints,
+				    unsigned int                 num_endpoints,
+				    glyphy_rgba_t               *region,
+				    unsigned int                 stride,
+				    unsigned int                 row_width,
+				    unsigned int                 max_rows,
+				    unsigned int                 row_quantum,
+				    unsigned int                *rows_used,
+				    double                       faraway,
+				    double                       avg_fetch_desired,
+				    double                      *avg_fetch_achieved,
+				    unsigned int                *output_len,
+				    unsigned int                *nominal_width,  /* 6bit */
+				    unsigned int                *nominal_height, /* 6bit */
+				    glyphy_extents_t            *extents);
+
+/* Same as glyphy_arc_list_encode_blob32() */
+glyphy_bool_t
+glyphy_blob_encoder_encode32 (glyphy_blob_encoder_t         *encoder,
+			      const glyphy_arc_endpoint32_t *endpoints,
+			      unsigned int                   num_endpoints,
+			      glyphy_rgba_t                 *blob,
+			      unsigned int                   blob_size,
+			      double                         faraway,
+			      double                         avg_fetch_desired,
+			      double                        *avg_fetch_achieved,
+			      unsigned int                  *output_len,
+			      unsigned int                  *nominal_width,  /* 6bit */
+			      unsigned int                  *nominal_height, /* 6bit */
+			      glyphy_extents_t              *extents);
+
+/* Decodes the arc list of the blob cell containing p, as the shader does.
+ * p, and the returned endpoints, are in nominal coordinates, ie. the glyph
+ * extents mapped to (0,0)-(nominal_width,nominal_height).
+ * Returns the number of endpoints in the list and stores up to
+ * max_endpoints of them.  The first endpoint is always a move-to (d is
+ * GLYPHY_INFINITY), so the list can be passed to glyphy_sdf_from_arc_list().
+ * Returns zero for cells that are far away from the outline or encode a
+ * single line; those have no list.  The shader fetches one texel for the
+ * cell plus one per endpoint. */
+unsigned int
+glyphy_arc_list_decode_blob (const glyphy_rgba_t   *blob,
+			     unsigned int           nominal_width,
+			     unsigned int           nominal_height,
+			     const glyphy_point_t  *p,
+			     glyphy_arc_endpoint_t *endpoints,
+			     unsigned int           max_endpoints);
 
 
 
@@ -317,13 +690,59 @@ glyphy_sdf_from_arc_list (const glyphy_arc_endpoint_t *endpoints,
 			  const glyphy_point_t        *p,
 			  glyphy_point_t              *closest_p /* may be NULL; TBD not implemented yet */);
 
-/* TBD */
+/* Batched version of the above, for many points at once.  Uses SSE2,
+ * or AVX if the library is built with it enabled. */
+void
+glyphy_sdf_from_arc_list_batch (const glyphy_arc_endpoint_t *endpoints,
+				unsigned int                 num_endpoints,
+				const glyphy_point_t        *points,
+				unsigned int                 num_points,
+				double                      *sdfs);
+
+/* Same as glyphy_sdf_from_arc_list(), but only looks at arcs near p.
+ * Queries reuse a buffer in arc_list, so they don't allocate once it has
+ * grown; don't query one arc list from more than one thread at once. */
+double
+glyphy_arc_list_sdf (glyphy_arc_list_t    *arc_list,
+		     const glyphy_point_t *p);
+
+void
+glyphy_arc_list_sdf_batch (glyphy_arc_list_t    *arc_list,
+			   const glyphy_point_t *points,
+			   unsigned int          num_points,
+			   double               *sdfs);
+
+/* Same as the batched versions above, calculated in single precision,
+ * which fits twice as many points in a SIMD register. */
+void
+glyphy_sdf_from_arc_list32_batch (const glyphy_arc_endpoint32_t *endpoints,
+				  unsigned int                   num_endpoints,
+				  const glyphy_point32_t        *points,
+				  unsigned int                   num_points,
+				  float                         *sdfs);
+
+void
+glyphy_arc_list_sdf32_batch (glyphy_arc_list_t      *arc_list,
+			     const glyphy_point32_t *points,
+			     unsigned int            num_points,
+			     float                  *sdfs);
+
+/* Same result as glyphy_sdf() in the shader, calculated on the CPU.
+ * p and the result are in nominal coordinates; see
+ * glyphy_arc_list_decode_blob(). */
 double
 glyphy_sdf_from_blob (const glyphy_rgba_t  *blob,
 		      unsigned int          nominal_width,
 		      unsigned int          nominal_height,
-		      const glyphy_point_t *p,
-		      glyphy_point_t       *closest_p /* may be NULL; TBD not implemented yet */);
+		      const glyphy_point_t *p);
+
+void
+glyphy_sdf_from_blob_batch (const glyphy_rgba_t  *blob,
+			    unsigned int          nominal_width,
+			    unsigned int          nominal_height,
+			    const glyphy_point_t *points,
+			    unsigned int          num_points,
+			    double               *sdfs);
 
 
 